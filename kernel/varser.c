@@ -10,6 +10,34 @@
 #include <linux/list.h>
 #include <linux/kref.h>
 #include <linux/string.h>
+#include <linux/sort.h>
+#include <linux/wait.h>
+#include <linux/sched/signal.h>
+#include <linux/jiffies.h>
+#include <linux/mm.h>
+#include <linux/bitmap.h>
+#include <linux/ktime.h>
+#include <linux/huge_mm.h>
+#include <linux/version.h>
+
+/* vm_flags_set()/vm_flags_clear() appeared in 6.3 */
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 3, 0)
+#error "varser needs Linux 6.3 or newer"
+#endif
+
+/* vmf_insert_pfn_pmd() takes a pfn_t before 6.17 and a plain pfn since */
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 17, 0)
+#include <linux/pfn_t.h>
+#define varser_pmd_pfn(pfn) pfn_to_pfn_t(pfn)
+#else
+#define varser_pmd_pfn(pfn) (pfn)
+#endif
+
+/* PMD mappings of pinned containers; ->huge_fault() takes the order since 6.6, older
+ * kernels map the same memory with 4 KB pages */
+#if defined(CONFIG_TRANSPARENT_HUGEPAGE) && LINUX_VERSION_CODE >= KERNEL_VERSION(6, 6, 0)
+#define VARSER_HUGE_FAULT
+#endif
 
 #include "varser_ioctl.h"
 
@@ -21,9 +49,27 @@ MODULE_DESCRIPTION("Varser container kernel module (skeleton)");
 struct varser_var {
     char name[VARSER_MAX_VAR_NAME];
     uint8_t type;
-    uint32_t size; /* allocated size */
-    void *data;    /* kernel buffer */
+    uint32_t size; /* declared size */
+    void *data;    /* kernel buffer (small variables) */
+    void *spare;   /* second buffer of small variables, SET copies here and swaps */
+    struct page **pages; /* page array (large variables), NULL entries read as zeros */
+    unsigned long *huge; /* pinned: 2 MB chunks that are one compound page (bitmap) */
+    int pinned;    /* page array fully populated and never released (mmap-able) */
+    int keep_pages; /* pages only go away with the variable: pinned, or read without a lock */
+    u64 map_off;   /* offset in the container mmap (pinned) */
+    u64 resident;  /* bytes actually allocated for the value */
+    u32 hist_depth; /* history ring, 0 = disabled */
+    u64 hist_head;  /* values pushed so far */
+    struct varser_history_entry *hist_slots; /* version/timestamp per slot */
+    void *hist_data; /* hist_depth values of size bytes */
+    const void *def; /* default value inside container's image, NULL = zeros */
+    u64 version;   /* bumped by every write, protected by the data lock */
+    u32 status;    /* VARSER_STATUS_* of the current value */
+    struct varser_map_status *mstat; /* pinned: entry in the mapped status page */
+    unsigned idx;  /* declaration order, used as lock order */
     struct rw_semaphore rw; /* per-variable rw lock */
+    atomic_t writers_waiting;    /* VARSER_PREFER_WRITERS: writers queued on rw */
+    wait_queue_head_t writer_wq; /* readers held back by writers_waiting, timed waits on rw */
     struct list_head list;
 };
 
@@ -33,8 +79,29 @@ struct varser_container {
     struct list_head vars;
     struct kref refcount;
     struct mutex container_lock; /* protects vars list */
+    struct mutex data_lock; /* all variable data under VARSER_LOCK_CONTAINER_MUTEX */
+    wait_queue_head_t data_wq; /* timed waits on data_lock */
     struct list_head list; /* global containers list linkage */
     int lock_policy;
+    int lock_pref;
+    int flags;      /* VARSER_REG_F_* */
+    u64 map_size;   /* mmap length, 0 unless VARSER_REG_F_HUGE_PAGES */
+    struct page *status_page; /* first page of the mmap: struct varser_map_status per variable */
+    struct list_head owners;  /* struct varser_owner per fd, under container_lock */
+    unsigned owner_count;
+    atomic_t map_count;       /* live mappings */
+    unsigned var_count;
+    void *defaults;      /* initial image from REGISTER (kvmalloc), may be NULL */
+    u64 defaults_size;
+};
+
+/* one per fd that has the container open (LIST_OWNERS) */
+struct varser_owner {
+    struct file *file;
+    pid_t pid;
+    char comm[TASK_COMM_LEN];
+    u64 opened_ns;
+    struct list_head list;
 };
 
 static LIST_HEAD(container_list);
@@ -51,41 +118,441 @@ static struct varser_container *find_container_locked(const char *name)
     return NULL;
 }
 
-/* release function for kref */
-static void varser_container_release(struct kref *kref)
+/* helper: storage size of a declared variable */
+static u32 varser_desc_size(const struct varser_var_desc *d)
 {
-    struct varser_container *c = container_of(kref, struct varser_container, refcount);
-    struct varser_var *v, *tmp;
+    return d->size ? d->size : VARSER_DEFAULT_VAR_SIZE;
+}
 
-    mutex_lock(&c->container_lock);
+/* helper: size of the initial image a REGISTER must carry */
+static u64 varser_image_size(const struct varser_register *reg)
+{
+    u64 total = 0;
+    unsigned i;
+    for (i = 0; i < reg->var_count && i < VARSER_MAX_VARS; ++i) {
+        if (reg->vars[i].flags & VARSER_VAR_F_DEFAULT)
+            total += varser_desc_size(&reg->vars[i]);
+    }
+    return total;
+}
+
+/* history rings are preallocated, refuse them up front rather than failing the allocation;
+ * a ring's values are one kvmalloc, which WARNs above INT_MAX
+ */
+static bool varser_history_valid(const struct varser_register *reg)
+{
+    unsigned i;
+    for (i = 0; i < reg->var_count && i < VARSER_MAX_VARS; ++i) {
+        if (reg->vars[i].history > VARSER_MAX_HISTORY) return false;
+        if ((u64)reg->vars[i].history * varser_desc_size(&reg->vars[i]) > INT_MAX) return false;
+    }
+    return true;
+}
+
+/* Storage: small variables live in one kzalloc'ed buffer. Variables of at least
+ * VARSER_SPARSE_MIN bytes get a page array instead: a page is allocated on the first
+ * non-zero write to it, pages that are missing read as zeros.
+ */
+#define VARSER_SPARSE_MIN  (16 * PAGE_SIZE)
+
+static unsigned long varser_var_nr_pages(const struct varser_var *v)
+{
+    return DIV_ROUND_UP(v->size, PAGE_SIZE);
+}
+
+/* bytes of the variable stored in page i */
+static size_t varser_page_len(const struct varser_var *v, unsigned long i)
+{
+    return min_t(size_t, PAGE_SIZE, v->size - i * PAGE_SIZE);
+}
+
+static int varser_var_alloc(struct varser_var *v)
+{
+    if (v->size >= VARSER_SPARSE_MIN) {
+        v->pages = kvcalloc(varser_var_nr_pages(v), sizeof(*v->pages), GFP_KERNEL);
+        return v->pages ? 0 : -ENOMEM;
+    }
+    v->data = kzalloc(v->size, GFP_KERNEL);
+    v->spare = kzalloc(v->size, GFP_KERNEL);
+    if (!v->data || !v->spare) {
+        kfree(v->data);
+        kfree(v->spare);
+        v->data = v->spare = NULL;
+        return -ENOMEM;
+    }
+    v->resident = 2 * (u64)v->size;
+    return 0;
+}
+
+/* Pinned storage (VARSER_REG_F_HUGE_PAGES): every variable gets a fully populated page
+ * array that stays in place for the container's lifetime, so it can be mmapped.
+ * Each whole 2 MB chunk is first tried as one compound page, then as single pages.
+ */
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+#define VARSER_HUGE_ORDER  HPAGE_PMD_ORDER
+#else
+#define VARSER_HUGE_ORDER  0
+#endif
+#define VARSER_HUGE_NR     (1UL << VARSER_HUGE_ORDER) /* pages per chunk */
+
+static void varser_var_free_data(struct varser_var *v)
+{
+    unsigned long i;
+    if (v->pages) {
+        for (i = 0; i < varser_var_nr_pages(v); ++i) {
+            if (v->huge && test_bit(i / VARSER_HUGE_NR, v->huge)) {
+                if (i % VARSER_HUGE_NR == 0) __free_pages(v->pages[i], VARSER_HUGE_ORDER);
+                continue;
+            }
+            if (v->pages[i]) __free_page(v->pages[i]);
+        }
+        kvfree(v->pages);
+        v->pages = NULL;
+    }
+    bitmap_free(v->huge);
+    v->huge = NULL;
+    kfree(v->data);
+    kfree(v->spare);
+    v->data = v->spare = NULL;
+    v->resident = 0;
+}
+
+/* Page allocation and release happen under the variable's write lock, which every
+ * lock policy takes for writes. Unlocked readers (lock_policy none) only ever see a
+ * zeroed page published with release semantics, and keep_pages stops it being freed.
+ */
+static int varser_var_add_page(struct varser_var *v, unsigned long i)
+{
+    struct page *pg;
+    if (v->pages[i]) return 0;
+    pg = alloc_page(GFP_KERNEL | __GFP_ZERO);
+    if (!pg) return -ENOMEM;
+    smp_store_release(&v->pages[i], pg);
+    v->resident += PAGE_SIZE;
+    return 0;
+}
+
+static int varser_var_alloc_pinned(struct varser_var *v)
+{
+    unsigned long i, j, n, nr = varser_var_nr_pages(v);
+
+    v->pinned = 1;
+    v->keep_pages = 1;
+    v->pages = kvcalloc(nr, sizeof(*v->pages), GFP_KERNEL);
+    v->huge = bitmap_zalloc(DIV_ROUND_UP(nr, VARSER_HUGE_NR), GFP_KERNEL);
+    if (!v->pages || !v->huge) goto err;
+    for (i = 0; i < nr; i += VARSER_HUGE_NR) {
+        struct page *head = NULL;
+        n = min(nr - i, VARSER_HUGE_NR);
+        if (VARSER_HUGE_ORDER && n == VARSER_HUGE_NR)
+            head = alloc_pages(GFP_KERNEL | __GFP_ZERO | __GFP_COMP | __GFP_NOWARN | __GFP_NORETRY,
+                               VARSER_HUGE_ORDER);
+        if (head) {
+            for (j = 0; j < n; ++j) v->pages[i + j] = nth_page(head, j);
+            set_bit(i / VARSER_HUGE_NR, v->huge);
+            v->resident += n * PAGE_SIZE;
+            continue;
+        }
+        for (j = 0; j < n; ++j) {
+            if (varser_var_add_page(v, i + j)) goto err;
+        }
+    }
+    return 0;
+err:
+    varser_var_free_data(v);
+    return -ENOMEM;
+}
+
+/* bytes of a pinned variable that sit on 2 MB pages */
+static u64 varser_var_huge_bytes(const struct varser_var *v)
+{
+    if (!v->huge) return 0;
+    return (u64)bitmap_weight(v->huge, DIV_ROUND_UP(varser_var_nr_pages(v), VARSER_HUGE_NR)) *
+           VARSER_HUGE_NR * PAGE_SIZE;
+}
+
+static void varser_var_drop_page(struct varser_var *v, unsigned long i)
+{
+    if (!v->pages[i]) return;
+    if (v->keep_pages) { /* may be mapped or read unlocked: keep the page, zero it */
+        memset(page_address(v->pages[i]), 0, PAGE_SIZE);
+        return;
+    }
+    __free_page(v->pages[i]);
+    v->pages[i] = NULL;
+    v->resident -= PAGE_SIZE;
+}
+
+/* Allocates the pages a later varser_var_write_kernel(v, src) needs, so that one
+ * can't fail halfway. Only non-zero parts of src need a page. Call under the write lock.
+ */
+static int varser_var_reserve(struct varser_var *v, const void *src)
+{
+    unsigned long i;
+    int ret;
+    if (!v->pages || !src) return 0;
+    for (i = 0; i < varser_var_nr_pages(v); ++i) {
+        if (!memchr_inv((const u8 *)src + i * PAGE_SIZE, 0, varser_page_len(v, i)))
+            continue;
+        ret = varser_var_add_page(v, i);
+        if (ret) return ret;
+    }
+    return 0;
+}
+
+/* copies a full value from kernel memory (src == NULL writes zeros); pages that end up
+ * all zero are released. Paged variables need varser_var_reserve() first.
+ */
+static void varser_var_write_kernel(struct varser_var *v, const void *src)
+{
+    unsigned long i;
+    if (!v->pages) {
+        if (src) memcpy(v->data, src, v->size);
+        else memset(v->data, 0, v->size);
+        return;
+    }
+    for (i = 0; i < varser_var_nr_pages(v); ++i) {
+        const u8 *chunk = src ? (const u8 *)src + i * PAGE_SIZE : NULL;
+        size_t len = varser_page_len(v, i);
+        if (!chunk || !memchr_inv(chunk, 0, len)) {
+            varser_var_drop_page(v, i);
+            continue;
+        }
+        memcpy(page_address(v->pages[i]), chunk, len);
+    }
+}
+
+/* copies a full value from user space; paged variables need a scratch page */
+static int varser_var_write_user(struct varser_var *v, const void __user *src, void *scratch)
+{
+    unsigned long i;
+
+    if (!v->pages) {
+        /* a fault midway leaves the current value untouched. Writers hold v->rw or the
+         * container mutex under every lock policy, so only one swaps at a time;
+         * unlocked readers may still copy a buffer being refilled (lock_policy none)
+         */
+        void *old = v->data;
+        if (copy_from_user(v->spare, src, v->size)) return -EFAULT;
+        smp_store_release(&v->data, v->spare);
+        v->spare = old;
+        return 0;
+    }
+
+    /* user memory can't be inspected in place: each chunk is copied to scratch first,
+     * so only non-zero chunks get a page
+     */
+    for (i = 0; i < varser_var_nr_pages(v); ++i) {
+        size_t len = varser_page_len(v, i);
+        int ret;
+        if (copy_from_user(scratch, (const u8 __user *)src + i * PAGE_SIZE, len)) return -EFAULT;
+        if (!memchr_inv(scratch, 0, len)) {
+            varser_var_drop_page(v, i);
+            continue;
+        }
+        ret = varser_var_add_page(v, i);
+        if (ret) return ret;
+        memcpy(page_address(v->pages[i]), scratch, len);
+    }
+    return 0;
+}
+
+/* copies a full value to user space; missing pages read as zeros without allocating */
+static int varser_var_read_user(struct varser_var *v, void __user *dst)
+{
+    unsigned long i;
+
+    if (!v->pages) /* both buffers live as long as the variable */
+        return copy_to_user(dst, READ_ONCE(v->data), v->size) ? -EFAULT : 0;
+    for (i = 0; i < varser_var_nr_pages(v); ++i) {
+        u8 __user *to = (u8 __user *)dst + i * PAGE_SIZE;
+        size_t len = varser_page_len(v, i);
+        struct page *pg = smp_load_acquire(&v->pages[i]); /* may run unlocked */
+        if (pg ? copy_to_user(to, page_address(pg), len) : clear_user(to, len))
+            return -EFAULT;
+    }
+    return 0;
+}
+
+/* copies the current value into a kernel buffer (missing pages as zeros) */
+static void varser_var_snapshot(const struct varser_var *v, void *dst)
+{
+    unsigned long i;
+    if (!v->pages) {
+        memcpy(dst, v->data, v->size);
+        return;
+    }
+    for (i = 0; i < varser_var_nr_pages(v); ++i) {
+        u8 *to = (u8 *)dst + i * PAGE_SIZE;
+        if (v->pages[i]) memcpy(to, page_address(v->pages[i]), varser_page_len(v, i));
+        else memset(to, 0, varser_page_len(v, i));
+    }
+}
+
+/* History ring, preallocated at REGISTER. Slot p % depth holds the p-th pushed value. */
+static int varser_history_alloc(struct varser_var *v, u32 depth)
+{
+    if (!depth) return 0;
+    if (depth > VARSER_MAX_HISTORY) return -EINVAL;
+    v->hist_slots = kvcalloc(depth, sizeof(*v->hist_slots), GFP_KERNEL);
+    v->hist_data = kvmalloc_array(depth, v->size, GFP_KERNEL | __GFP_NOWARN);
+    if (!v->hist_slots || !v->hist_data) {
+        kvfree(v->hist_slots);
+        kvfree(v->hist_data);
+        v->hist_slots = NULL;
+        v->hist_data = NULL;
+        return -ENOMEM;
+    }
+    v->hist_depth = depth;
+    return 0;
+}
+
+static void varser_history_free(struct varser_var *v)
+{
+    kvfree(v->hist_slots);
+    kvfree(v->hist_data);
+    v->hist_slots = NULL;
+    v->hist_data = NULL;
+    v->hist_depth = 0;
+}
+
+/* records the value just written; call under the write lock after bumping version */
+static void varser_history_push(struct varser_var *v)
+{
+    u64 slot;
+    if (!v->hist_depth) return;
+    slot = v->hist_head % v->hist_depth;
+    v->hist_slots[slot].version = v->version;
+    v->hist_slots[slot].timestamp_ns = ktime_get_ns();
+    varser_var_snapshot(v, (u8 *)v->hist_data + slot * v->size);
+    v->hist_head++;
+}
+
+/* copies every kept value newer than hr->since_version to user space; call under the
+ * variable's read lock, which READ_HISTORY takes under every lock policy
+ */
+static int varser_history_read(struct varser_var *v, struct varser_history_read *hr)
+{
+    u64 p, first, oldest_version;
+    u8 __user *out = (u8 __user *)((uintptr_t)hr->user_buf);
+
+    hr->entry_size = sizeof(struct varser_history_entry) + v->size;
+    hr->count = 0;
+    hr->dropped = 0;
+    if (!v->hist_depth) return -ENODATA;
+    if (!v->hist_head) return 0;
+
+    first = v->hist_head > v->hist_depth ? v->hist_head - v->hist_depth : 0;
+    oldest_version = v->hist_slots[first % v->hist_depth].version;
+    if (oldest_version > hr->since_version + 1)
+        hr->dropped = oldest_version - hr->since_version - 1;
+
+    for (p = first; p < v->hist_head && hr->count < hr->max_entries; ++p) {
+        const struct varser_history_entry *e = &v->hist_slots[p % v->hist_depth];
+        if (e->version <= hr->since_version) continue;
+        if (!out) return -EINVAL;
+        if (copy_to_user(out, e, sizeof(*e)) ||
+            copy_to_user(out + sizeof(*e), (u8 *)v->hist_data + (p % v->hist_depth) * v->size, v->size))
+            return -EFAULT;
+        out += hr->entry_size;
+        hr->count++;
+    }
+    return 0;
+}
+
+/* Write-in-progress marker around every change of a value, under its write lock.
+ * Paged values are copied in place, so a SET whose user buffer faults midway (also
+ * when the writer is being killed) or that runs out of pages leaves a mix of old and
+ * new data: the value is flagged VARSER_STATUS_TORN instead of looking valid. Small
+ * values are copied aside and swapped, a failed SET leaves them untouched. Pinned
+ * variables mirror seq and status into the mapped status page for lockless readers.
+ */
+static void varser_write_begin(struct varser_var *v)
+{
+    if (!v->mstat) return;
+    WRITE_ONCE(v->mstat->seq, v->mstat->seq + 1);
+    smp_wmb();
+}
+
+/* ret: result of the write, 0 = the whole value was written */
+static void varser_write_end(struct varser_var *v, int ret)
+{
+    if (!ret) {
+        v->status = 0;
+        v->version++;
+        varser_history_push(v);
+    } else if ((ret == -EFAULT || ret == -ENOMEM) && v->pages) {
+        v->status = VARSER_STATUS_TORN;
+        if (fatal_signal_pending(current)) v->status |= VARSER_STATUS_OWNER_DIED;
+        v->version++; /* the value did change: optimistic readers must notice */
+        pr_warn_ratelimited("varser: variable '%s' torn by pid %d\n", v->name, task_tgid_nr(current));
+    }
+    if (!v->mstat) return;
+    WRITE_ONCE(v->mstat->status, v->status);
+    smp_wmb();
+    WRITE_ONCE(v->mstat->seq, v->mstat->seq + 1);
+}
+
+/* helper: free all variables of a container */
+static void varser_free_vars(struct varser_container *c)
+{
+    struct varser_var *v, *tmp;
     list_for_each_entry_safe(v, tmp, &c->vars, list) {
         list_del(&v->list);
-        if (v->data) kfree(v->data);
+        varser_history_free(v);
+        varser_var_free_data(v);
         kfree(v);
     }
+}
+
+/* release function for kref */
+static void varser_container_release(struct kref *kref)
+{
+    struct varser_container *c = container_of(kref, struct varser_container, refcount);
+
+    mutex_lock(&c->container_lock);
+    varser_free_vars(c);
     mutex_unlock(&c->container_lock);
 
     mutex_lock(&global_list_lock);
     list_del(&c->list);
     mutex_unlock(&global_list_lock);
 
-    kfree(c);
     pr_info("varser: container '%s' freed\n", c->name);
+    if (c->status_page) __free_page(c->status_page);
+    kvfree(c->defaults);
+    kfree(c);
 }
 
-/* create/init container (called while holding global_list_lock or not) */
-static struct varser_container *varser_create_container(const struct varser_register *reg)
+/* create/init container (called while holding global_list_lock or not).
+ * image is the initial image (varser_image_size(reg) bytes, kvmalloc'ed) or NULL;
+ * on success the container takes ownership of it.
+ */
+static struct varser_container *varser_create_container(const struct varser_register *reg, void *image)
 {
     struct varser_container *c;
+    const u8 *img = image;
     unsigned i;
 
     c = kzalloc(sizeof(*c), GFP_KERNEL);
     if (!c) return NULL;
     INIT_LIST_HEAD(&c->vars);
+    INIT_LIST_HEAD(&c->owners);
+    atomic_set(&c->map_count, 0);
     mutex_init(&c->container_lock);
+    mutex_init(&c->data_lock);
+    init_waitqueue_head(&c->data_wq);
     kref_init(&c->refcount);
     strncpy(c->name, reg->container_name, VARSER_MAX_CONTAINER_NAME-1);
-    c->lock_policy = 0;
+    c->lock_policy = reg->lock_policy;
+    c->lock_pref = reg->lock_pref;
+    c->flags = reg->flags;
+    if (c->flags & VARSER_REG_F_HUGE_PAGES) {
+        BUILD_BUG_ON(VARSER_MAX_VARS * sizeof(struct varser_map_status) > PAGE_SIZE);
+        c->status_page = alloc_page(GFP_KERNEL | __GFP_ZERO);
+        if (!c->status_page) { kfree(c); return NULL; }
+        c->map_size = PAGE_SIZE;
+    }
 
     for (i = 0; i < reg->var_count && i < VARSER_MAX_VARS; ++i) {
         struct varser_var *v = kzalloc(sizeof(*v), GFP_KERNEL);
@@ -93,28 +560,520 @@ static struct varser_container *varser_create_container(const struct varser_regi
         INIT_LIST_HEAD(&v->list);
         strncpy(v->name, reg->vars[i].name, VARSER_MAX_VAR_NAME-1);
         v->type = reg->vars[i].type;
-        v->size = reg->vars[i].size ? reg->vars[i].size : 8; /* default small size */
-        v->data = kzalloc(v->size, GFP_KERNEL);
-        if (!v->data) { kfree(v); goto err_vars; }
+        v->idx = i;
+        v->size = varser_desc_size(&reg->vars[i]);
+        if (c->flags & VARSER_REG_F_HUGE_PAGES ? varser_var_alloc_pinned(v) : varser_var_alloc(v)) {
+            kfree(v);
+            goto err_vars;
+        }
+        /* lock_policy none: GET copies from pages without a lock, so none may be freed */
+        if (c->lock_policy == VARSER_LOCK_NONE) v->keep_pages = 1;
+        if (v->pinned) {
+            /* whole 2 MB chunks must be 2 MB aligned in the mapping to get PMD entries */
+            if (varser_var_nr_pages(v) >= VARSER_HUGE_NR)
+                c->map_size = ALIGN(c->map_size, VARSER_HUGE_NR * PAGE_SIZE);
+            v->map_off = c->map_size;
+            c->map_size += (u64)varser_var_nr_pages(v) * PAGE_SIZE;
+            v->mstat = (struct varser_map_status *)page_address(c->status_page) + i;
+        }
+        if (varser_history_alloc(v, reg->vars[i].history)) {
+            varser_var_free_data(v);
+            kfree(v);
+            goto err_vars;
+        }
+        if (img && (reg->vars[i].flags & VARSER_VAR_F_DEFAULT)) {
+            /* not yet visible to anyone: a plain copy is atomic enough */
+            v->def = img;
+            if (varser_var_reserve(v, img)) {
+                varser_history_free(v);
+                varser_var_free_data(v);
+                kfree(v);
+                goto err_vars;
+            }
+            varser_var_write_kernel(v, img);
+            img += v->size;
+        }
         init_rwsem(&v->rw);
+        atomic_set(&v->writers_waiting, 0);
+        init_waitqueue_head(&v->writer_wq);
         list_add_tail(&v->list, &c->vars);
     }
 
+    c->var_count = i;
+    c->defaults = image;
+    c->defaults_size = image ? varser_image_size(reg) : 0;
     list_add_tail(&c->list, &container_list);
     pr_info("varser: created container '%s' vars=%u\n", c->name, reg->var_count);
+    if (c->map_size)
+        pr_info("varser: container '%s' mmap size %llu\n", c->name, (unsigned long long)c->map_size);
     return c;
 
 err_vars:
-    {
-        struct varser_var *vv, *tmp;
-        list_for_each_entry_safe(vv, tmp, &c->vars, list) {
-            list_del(&vv->list);
-            if (vv->data) kfree(vv->data);
-            kfree(vv);
+    varser_free_vars(c);
+    if (c->status_page) __free_page(c->status_page);
+    kfree(c);
+    return NULL;
+}
+
+/* how long a lock acquisition may wait */
+struct varser_wait {
+    int nonblock;           /* trylock only: -EAGAIN */
+    int timed;              /* give up at deadline: -ETIMEDOUT */
+    unsigned long deadline; /* jiffies */
+};
+
+static void varser_wait_init(struct varser_wait *w, struct file *file, u32 flags, u32 timeout_ms)
+{
+    w->nonblock = (file->f_flags & O_NONBLOCK) || (flags & VARSER_ACCESS_NONBLOCK);
+    w->timed = !w->nonblock && (flags & VARSER_ACCESS_TIMEOUT);
+    w->deadline = jiffies + msecs_to_jiffies(timeout_ms);
+}
+
+/* Timed acquisition. rwsem and mutex have no timed lock, so a deadline waiter sleeps
+ * on wq (woken by every unlock) and retries the trylock. It doesn't queue on the lock
+ * itself, so it can lose to blocking waiters; a fatal signal aborts.
+ */
+static int varser_timed_lock(wait_queue_head_t *wq, int (*trylock)(void *), void *lock,
+                             const struct varser_wait *w)
+{
+    long remaining;
+
+    if (trylock(lock)) return 0;
+    remaining = (long)(w->deadline - jiffies);
+    if (remaining <= 0) return -ETIMEDOUT;
+    remaining = wait_event_killable_timeout(*wq, trylock(lock), remaining);
+    if (remaining < 0) return -EINTR;
+    return remaining ? 0 : -ETIMEDOUT;
+}
+
+static int varser_mutex_trylock(void *m) { return mutex_trylock(m); }
+static int varser_read_trylock(void *rw) { return down_read_trylock(rw); }
+static int varser_write_trylock(void *rw) { return down_write_trylock(rw); }
+
+static int varser_mutex_lock(struct mutex *m, wait_queue_head_t *wq, const struct varser_wait *w)
+{
+    if (w->nonblock) return mutex_trylock(m) ? 0 : -EAGAIN;
+    if (!w->timed) return mutex_lock_killable(m);
+    return varser_timed_lock(wq, varser_mutex_trylock, m, w);
+}
+
+static int varser_down_read(struct rw_semaphore *rw, wait_queue_head_t *wq, const struct varser_wait *w)
+{
+    if (w->nonblock) return down_read_trylock(rw) ? 0 : -EAGAIN;
+    if (!w->timed) return down_read_killable(rw);
+    return varser_timed_lock(wq, varser_read_trylock, rw, w);
+}
+
+static int varser_down_write(struct rw_semaphore *rw, wait_queue_head_t *wq, const struct varser_wait *w)
+{
+    if (w->nonblock) return down_write_trylock(rw) ? 0 : -EAGAIN;
+    if (!w->timed) return down_write_killable(rw);
+    return varser_timed_lock(wq, varser_write_trylock, rw, w);
+}
+
+/* unlock and let timed waiters retry */
+static void varser_var_up(struct varser_var *v, int write)
+{
+    if (write) up_write(&v->rw);
+    else up_read(&v->rw);
+    if (wq_has_sleeper(&v->writer_wq)) wake_up_all(&v->writer_wq);
+}
+
+static void varser_data_unlock(struct varser_container *c)
+{
+    mutex_unlock(&c->data_lock);
+    if (wq_has_sleeper(&c->data_wq)) wake_up_all(&c->data_wq);
+}
+
+/* writer preference: a new reader first waits until no writer is queued on the variable */
+static int varser_wait_writers(struct varser_var *v, const struct varser_wait *w)
+{
+    long remaining;
+
+    if (!atomic_read(&v->writers_waiting)) return 0;
+    if (w->nonblock) return -EAGAIN;
+    if (!w->timed)
+        return wait_event_killable(v->writer_wq, !atomic_read(&v->writers_waiting)) ? -EINTR : 0;
+    remaining = (long)(w->deadline - jiffies);
+    if (remaining <= 0) return -ETIMEDOUT;
+    remaining = wait_event_killable_timeout(v->writer_wq, !atomic_read(&v->writers_waiting), remaining);
+    if (remaining < 0) return -EINTR;
+    return remaining ? 0 : -ETIMEDOUT;
+}
+
+static int varser_var_down_read(struct varser_container *c, struct varser_var *v,
+                                const struct varser_wait *w)
+{
+    if (c->lock_pref == VARSER_PREFER_WRITERS) {
+        int ret = varser_wait_writers(v, w);
+        if (ret) return ret;
+    }
+    return varser_down_read(&v->rw, &v->writer_wq, w);
+}
+
+static int varser_var_down_write(struct varser_container *c, struct varser_var *v,
+                                 const struct varser_wait *w)
+{
+    int ret;
+    if (c->lock_pref != VARSER_PREFER_WRITERS) return varser_down_write(&v->rw, &v->writer_wq, w);
+    atomic_inc(&v->writers_waiting);
+    ret = varser_down_write(&v->rw, &v->writer_wq, w);
+    if (atomic_dec_and_test(&v->writers_waiting)) wake_up_all(&v->writer_wq);
+    return ret;
+}
+
+/* lock helpers honoring the container's lock policy */
+static int varser_lock_var(struct varser_container *c, struct varser_var *v, int write,
+                           const struct varser_wait *w)
+{
+    switch (c->lock_policy) {
+    case VARSER_LOCK_NONE:
+        /* readers go unlocked; writers still exclude each other, so storage,
+         * version and history are only ever changed by one writer at a time
+         */
+        return write ? varser_var_down_write(c, v, w) : 0;
+    case VARSER_LOCK_CONTAINER_MUTEX:
+        return varser_mutex_lock(&c->data_lock, &c->data_wq, w);
+    default:
+        return write ? varser_var_down_write(c, v, w) : varser_var_down_read(c, v, w);
+    }
+}
+
+static void varser_unlock_var(struct varser_container *c, struct varser_var *v, int write)
+{
+    switch (c->lock_policy) {
+    case VARSER_LOCK_NONE:
+        if (write) varser_var_up(v, 1);
+        break;
+    case VARSER_LOCK_CONTAINER_MUTEX:
+        varser_data_unlock(c);
+        break;
+    default:
+        varser_var_up(v, write);
+    }
+}
+
+/* set of variables locked together (commit, reset) */
+struct varser_lock_ent {
+    struct varser_var *v;
+    int write;
+};
+
+static int varser_lock_ent_cmp(const void *a, const void *b)
+{
+    const struct varser_lock_ent *x = a, *y = b;
+    if (x->v->idx != y->v->idx) return x->v->idx < y->v->idx ? -1 : 1;
+    return 0;
+}
+
+/* sorts by declaration order and merges duplicates (write wins); returns new count */
+static unsigned varser_lock_set_prepare(struct varser_lock_ent *ents, unsigned n)
+{
+    unsigned i, out = 0;
+    sort(ents, n, sizeof(*ents), varser_lock_ent_cmp, NULL);
+    for (i = 0; i < n; ++i) {
+        if (out && ents[out-1].v == ents[i].v) {
+            ents[out-1].write |= ents[i].write;
+            continue;
+        }
+        ents[out++] = ents[i];
+    }
+    return out;
+}
+
+/* Locks a prepared set in declaration order, so two multi-variable operations can't deadlock.
+ * Under VARSER_LOCK_NONE the variables are still locked: read entries exclude writers
+ * while COMMIT validates them, only plain GET stays unlocked.
+ */
+static int varser_lock_set(struct varser_container *c, struct varser_lock_ent *ents, unsigned n,
+                           const struct varser_wait *w)
+{
+    unsigned i;
+    int ret;
+    if (c->lock_policy == VARSER_LOCK_CONTAINER_MUTEX)
+        return varser_mutex_lock(&c->data_lock, &c->data_wq, w);
+    for (i = 0; i < n; ++i) {
+        ret = ents[i].write ? varser_var_down_write(c, ents[i].v, w)
+                            : varser_var_down_read(c, ents[i].v, w);
+        if (ret) {
+            /* back out what we already hold */
+            while (i-- > 0)
+                varser_var_up(ents[i].v, ents[i].write);
+            return ret;
+        }
+    }
+    return 0;
+}
+
+static void varser_unlock_set(struct varser_container *c, struct varser_lock_ent *ents, unsigned n)
+{
+    unsigned i;
+    if (c->lock_policy == VARSER_LOCK_CONTAINER_MUTEX) {
+        varser_data_unlock(c);
+        return;
+    }
+    for (i = n; i-- > 0; )
+        varser_var_up(ents[i].v, ents[i].write);
+}
+
+/* helper: rewrite every variable with its default as one atomic update */
+static int varser_reset_defaults(struct varser_container *c, const struct varser_wait *w)
+{
+    struct varser_lock_ent *ents;
+    struct varser_var *v;
+    unsigned n = 0, i;
+    int ret;
+
+    ents = kmalloc_array(max(c->var_count, 1u), sizeof(*ents), GFP_KERNEL);
+    if (!ents) return -ENOMEM;
+    list_for_each_entry(v, &c->vars, list) {
+        ents[n].v = v;
+        ents[n].write = 1;
+        ++n;
+    }
+    /* list is already in declaration order */
+    ret = varser_lock_set(c, ents, n, w);
+    if (ret) {
+        kfree(ents);
+        return ret;
+    }
+    for (i = 0; i < n && !ret; ++i)
+        ret = varser_var_reserve(ents[i].v, ents[i].v->def);
+    for (i = 0; i < n && !ret; ++i) {
+        v = ents[i].v;
+        varser_write_begin(v);
+        varser_var_write_kernel(v, v->def);
+        varser_write_end(v, 0);
+    }
+    varser_unlock_set(c, ents, n);
+    kfree(ents);
+    return ret;
+}
+
+/* helper: find variable by name (takes container_lock) */
+static struct varser_var *find_var(struct varser_container *c, const char *name)
+{
+    struct varser_var *v;
+    mutex_lock(&c->container_lock);
+    list_for_each_entry(v, &c->vars, list) {
+        if (strncmp(v->name, name, VARSER_MAX_VAR_NAME) == 0) {
+            mutex_unlock(&c->container_lock);
+            return v;
+        }
+    }
+    mutex_unlock(&c->container_lock);
+    return NULL;
+}
+
+/* helper: copy user buffer into variable under its write lock */
+static int varser_var_set(struct varser_container *c, struct varser_var *v,
+                          unsigned long user_buf, u32 buf_size, const struct varser_wait *w)
+{
+    void *scratch = NULL;
+    int ret;
+    if (buf_size < v->size || user_buf == 0) return -EINVAL;
+    if (v->pages) {
+        scratch = (void *)__get_free_page(GFP_KERNEL);
+        if (!scratch) return -ENOMEM;
+    }
+    ret = varser_lock_var(c, v, 1, w);
+    if (ret) goto out;
+    varser_write_begin(v);
+    ret = varser_var_write_user(v, (void __user *)((uintptr_t)user_buf), scratch);
+    varser_write_end(v, ret);
+    varser_unlock_var(c, v, 1);
+out:
+    free_page((unsigned long)scratch);
+    return ret;
+}
+
+/* helper: copy variable to user buffer under its read lock, reports version and status read */
+static int varser_var_get(struct varser_container *c, struct varser_var *v,
+                          unsigned long user_buf, u32 buf_size, u64 *version, u32 *status,
+                          const struct varser_wait *w)
+{
+    int ret;
+    if (buf_size < v->size || user_buf == 0) return -EINVAL;
+    ret = varser_lock_var(c, v, 0, w);
+    if (ret) return ret;
+    ret = varser_var_read_user(v, (void __user *)((uintptr_t)user_buf));
+    *version = v->version;
+    *status = v->status;
+    varser_unlock_var(c, v, 0);
+    return ret;
+}
+
+/* COMMIT: validate read versions and apply all writes under one lock set */
+static int varser_commit(struct varser_container *c, struct varser_commit *cm,
+                         const struct varser_wait *w)
+{
+    struct varser_tx_read *reads = NULL;
+    struct varser_batch_entry *writes = NULL;
+    struct varser_var **rvars = NULL, **wvars = NULL;
+    void **payload = NULL;
+    struct varser_lock_ent *ents = NULL;
+    unsigned i, j, n = 0, nw = 0;
+    int ret = 0;
+
+    if (cm->read_count > VARSER_MAX_VARS || cm->write_count > VARSER_MAX_VARS) return -EINVAL;
+    if ((cm->read_count && !cm->reads) || (cm->write_count && !cm->writes)) return -EINVAL;
+    if (!cm->read_count && !cm->write_count) return 0;
+
+    reads = kmalloc_array(max(cm->read_count, 1u), sizeof(*reads), GFP_KERNEL);
+    writes = kmalloc_array(max(cm->write_count, 1u), sizeof(*writes), GFP_KERNEL);
+    rvars = kcalloc(max(cm->read_count, 1u), sizeof(*rvars), GFP_KERNEL);
+    wvars = kcalloc(max(cm->write_count, 1u), sizeof(*wvars), GFP_KERNEL);
+    payload = kcalloc(max(cm->write_count, 1u), sizeof(*payload), GFP_KERNEL);
+    ents = kmalloc_array(cm->read_count + cm->write_count, sizeof(*ents), GFP_KERNEL);
+    if (!reads || !writes || !rvars || !wvars || !payload || !ents) { ret = -ENOMEM; goto out; }
+
+    if (copy_from_user(reads, (void __user *)((uintptr_t)cm->reads), cm->read_count * sizeof(*reads)) ||
+        copy_from_user(writes, (void __user *)((uintptr_t)cm->writes), cm->write_count * sizeof(*writes))) {
+        ret = -EFAULT;
+        goto out;
+    }
+
+    for (i = 0; i < cm->read_count; ++i) {
+        reads[i].var_name[VARSER_MAX_VAR_NAME-1] = '\0';
+        rvars[i] = find_var(c, reads[i].var_name);
+        if (!rvars[i]) { ret = -ENOENT; goto out; }
+        ents[n].v = rvars[i];
+        ents[n].write = 0;
+        ++n;
+    }
+    /* stage payloads up front: no faults under locks, and applying can't fail halfway */
+    for (i = 0; i < cm->write_count; ++i) {
+        writes[i].var_name[VARSER_MAX_VAR_NAME-1] = '\0';
+        wvars[i] = find_var(c, writes[i].var_name);
+        if (!wvars[i]) { ret = -ENOENT; goto out; }
+        if (writes[i].buf_size < wvars[i]->size || !writes[i].user_buf) { ret = -EINVAL; goto out; }
+        /* kvmalloc WARNs above INT_MAX: such variables are written with SET only */
+        if (wvars[i]->size > INT_MAX) { ret = -E2BIG; goto out; }
+        payload[i] = kvmalloc(wvars[i]->size, GFP_KERNEL | __GFP_NOWARN);
+        if (!payload[i]) { ret = -ENOMEM; goto out; }
+        if (copy_from_user(payload[i], (void __user *)((uintptr_t)writes[i].user_buf), wvars[i]->size)) {
+            ret = -EFAULT;
+            goto out;
+        }
+        ents[n].v = wvars[i];
+        ents[n].write = 1;
+        ++n;
+    }
+    /* A variable written twice keeps its last value. Earlier payloads are dropped so
+     * every variable is reserved and written once: applying them all could release a
+     * page for a zero chunk that a later payload was promised.
+     */
+    for (i = 0; i < cm->write_count; ++i) {
+        for (j = i + 1; j < cm->write_count && wvars[j] != wvars[i]; ++j)
+            ;
+        if (j < cm->write_count) {
+            kvfree(payload[i]);
+            payload[i] = NULL;
+            continue;
+        }
+        wvars[nw] = wvars[i];
+        payload[nw] = payload[i];
+        if (nw++ != i) payload[i] = NULL;
+    }
+
+    n = varser_lock_set_prepare(ents, n);
+    ret = varser_lock_set(c, ents, n, w);
+    if (ret) goto out;
+    for (i = 0; i < cm->read_count; ++i) {
+        if (rvars[i]->version != reads[i].version) {
+            cm->conflict_index = i;
+            ret = -VARSER_COMMIT_CONFLICT;
+            break;
         }
-        kfree(c);
-        return NULL;
     }
+    /* pages for sparse variables are allocated before anything is applied */
+    for (i = 0; i < nw && !ret; ++i)
+        ret = varser_var_reserve(wvars[i], payload[i]);
+    if (!ret) {
+        for (i = 0; i < nw; ++i) {
+            varser_write_begin(wvars[i]);
+            varser_var_write_kernel(wvars[i], payload[i]);
+            varser_write_end(wvars[i], 0);
+        }
+    }
+    varser_unlock_set(c, ents, n);
+
+out:
+    if (payload) {
+        for (i = 0; i < cm->write_count; ++i) kvfree(payload[i]);
+    }
+    kfree(ents);
+    kfree(payload);
+    kfree(wvars);
+    kfree(rvars);
+    kfree(writes);
+    kfree(reads);
+    return ret;
+}
+
+/* helper: fill schema of a container as it was registered */
+static void varser_fill_schema(struct varser_container *c, struct varser_register *reg)
+{
+    struct varser_var *v;
+    unsigned i = 0;
+
+    memset(reg, 0, sizeof(*reg));
+    strncpy(reg->container_name, c->name, VARSER_MAX_CONTAINER_NAME-1);
+    reg->lock_policy = c->lock_policy;
+    reg->lock_pref = c->lock_pref;
+    reg->flags = c->flags;
+    mutex_lock(&c->container_lock);
+    list_for_each_entry(v, &c->vars, list) {
+        if (i >= VARSER_MAX_VARS) break;
+        strncpy(reg->vars[i].name, v->name, VARSER_MAX_VAR_NAME-1);
+        reg->vars[i].type = v->type;
+        reg->vars[i].size = v->size;
+        reg->vars[i].flags = v->def ? VARSER_VAR_F_DEFAULT : 0;
+        reg->vars[i].history = v->hist_depth;
+        reg->vars[i].map_offset = v->map_off;
+        ++i;
+    }
+    mutex_unlock(&c->container_lock);
+    reg->var_count = i;
+}
+
+/* helper: declared vs resident memory; resident is read without var locks (a snapshot) */
+static void varser_fill_stat(struct varser_container *c, struct varser_stat *st)
+{
+    struct varser_var *v;
+    unsigned i = 0;
+
+    memset(st, 0, sizeof(*st));
+    list_for_each_entry(v, &c->vars, list) {
+        u64 resident = READ_ONCE(v->resident);
+        if (i < VARSER_MAX_VARS) st->var_resident[i++] = resident;
+        st->declared_bytes += v->size;
+        st->resident_bytes += resident;
+        st->huge_bytes += varser_var_huge_bytes(v);
+    }
+    st->var_count = i;
+    st->map_size = c->map_size;
+}
+
+/* drops the fd's owner record and its container reference */
+static void varser_detach(struct file *file)
+{
+    struct varser_container *c = file->private_data;
+    struct varser_owner *o;
+
+    if (!c) return;
+    file->private_data = NULL;
+    mutex_lock(&c->container_lock);
+    list_for_each_entry(o, &c->owners, list) {
+        if (o->file == file) {
+            list_del(&o->list);
+            c->owner_count--;
+            kfree(o);
+            break;
+        }
+    }
+    mutex_unlock(&c->container_lock);
+    kref_put(&c->refcount, varser_container_release);
 }
 
 /* file->private_data will store pointer to container when opened with OPEN_CONTAINER */
@@ -127,44 +1086,231 @@ static long varser_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
     switch (cmd) {
     case VARSER_IOCTL_REGISTER:
     {
-        struct varser_register reg;
-        if (copy_from_user(&reg, uarg, sizeof(reg))) return -EFAULT;
+        struct varser_register *reg;
+        void *image = NULL;
+        u64 image_size;
+        int ret = 0;
 
-        mutex_lock(&global_list_lock);
-        if (find_container_locked(reg.container_name)) {
-            mutex_unlock(&global_list_lock);
-            return -EEXIST;
+        reg = kmalloc(sizeof(*reg), GFP_KERNEL);
+        if (!reg) return -ENOMEM;
+        if (copy_from_user(reg, uarg, sizeof(*reg))) { kfree(reg); return -EFAULT; }
+        reg->container_name[VARSER_MAX_CONTAINER_NAME-1] = '\0';
+
+        /* the initial image must cover exactly the variables flagged with a default
+         * and fit one kvmalloc (which WARNs above INT_MAX)
+         */
+        image_size = varser_image_size(reg);
+        if (reg->image_size != image_size || (image_size && !reg->image) || image_size > INT_MAX ||
+            reg->lock_policy > VARSER_LOCK_MAX || reg->lock_pref > VARSER_PREFER_WRITERS ||
+            (reg->flags & ~VARSER_REG_F_HUGE_PAGES) || !varser_history_valid(reg)) {
+            kfree(reg);
+            return -EINVAL;
         }
-        if (!varser_create_container(&reg)) {
-            mutex_unlock(&global_list_lock);
-            return -ENOMEM;
+        if (image_size) {
+            image = kvmalloc(image_size, GFP_KERNEL | __GFP_NOWARN);
+            if (!image) { kfree(reg); return -ENOMEM; }
+            if (copy_from_user(image, (void __user *)((uintptr_t)reg->image), image_size)) {
+                kvfree(image);
+                kfree(reg);
+                return -EFAULT;
+            }
         }
+
+        mutex_lock(&global_list_lock);
+        if (find_container_locked(reg->container_name))
+            ret = -EEXIST;
+        else if (!varser_create_container(reg, image))
+            ret = -ENOMEM;
         mutex_unlock(&global_list_lock);
-        return 0;
+        if (ret) kvfree(image);
+        kfree(reg);
+        return ret;
+    }
+    case VARSER_IOCTL_GET_SCHEMA:
+    {
+        struct varser_register *reg;
+        struct varser_container *c;
+        int ret = 0;
+
+        unsigned long image;
+        u64 image_cap;
+
+        reg = kmalloc(sizeof(*reg), GFP_KERNEL);
+        if (!reg) return -ENOMEM;
+        if (copy_from_user(reg, uarg, sizeof(*reg))) {
+            kfree(reg);
+            return -EFAULT;
+        }
+        reg->container_name[VARSER_MAX_CONTAINER_NAME-1] = '\0';
+        image = reg->image;
+        image_cap = reg->image_size;
+
+        /* take a reference so the container can't go away while we copy it */
+        mutex_lock(&global_list_lock);
+        c = find_container_locked(reg->container_name);
+        if (c) kref_get(&c->refcount);
+        mutex_unlock(&global_list_lock);
+        if (!c) {
+            kfree(reg);
+            return -ENOENT;
+        }
+        varser_fill_schema(c, reg);
+        /* defaults image is immutable after creation, no var locks needed */
+        reg->image = image;
+        reg->image_size = c->defaults_size;
+        if (image && c->defaults_size && image_cap >= c->defaults_size &&
+            copy_to_user((void __user *)((uintptr_t)image), c->defaults, c->defaults_size))
+            ret = -EFAULT;
+        kref_put(&c->refcount, varser_container_release);
+
+        if (!ret && copy_to_user(uarg, reg, sizeof(*reg))) ret = -EFAULT;
+        kfree(reg);
+        return ret;
     }
     case VARSER_IOC_OPEN_CONTAINER:
     {
         char name[VARSER_MAX_CONTAINER_NAME];
         struct varser_container *c;
+        struct varser_owner *owner;
         if (copy_from_user(name, uarg, VARSER_MAX_CONTAINER_NAME)) return -EFAULT;
+        name[VARSER_MAX_CONTAINER_NAME-1] = '\0';
 
+        owner = kzalloc(sizeof(*owner), GFP_KERNEL);
+        if (!owner) return -ENOMEM;
         mutex_lock(&global_list_lock);
         c = find_container_locked(name);
         if (!c) {
             mutex_unlock(&global_list_lock);
+            kfree(owner);
             return -ENOENT;
         }
         kref_get(&c->refcount);
         mutex_unlock(&global_list_lock);
+
+        varser_detach(file); /* reopening an fd switches containers */
+        owner->file = file;
+        owner->pid = task_tgid_nr(current);
+        get_task_comm(owner->comm, current);
+        owner->opened_ns = ktime_get_ns();
+        mutex_lock(&c->container_lock);
+        list_add_tail(&owner->list, &c->owners);
+        c->owner_count++;
+        mutex_unlock(&c->container_lock);
         file->private_data = c;
         return 0;
     }
     case VARSER_IOC_CLOSE_CONTAINER:
+    {
+        if (!file->private_data) return -EINVAL;
+        varser_detach(file);
+        return 0;
+    }
+    case VARSER_IOCTL_LIST_OWNERS:
+    {
+        struct varser_owners *ow;
+        struct varser_container *c;
+        struct varser_owner *o;
+        unsigned i = 0;
+        int ret = 0;
+
+        ow = kzalloc(sizeof(*ow), GFP_KERNEL);
+        if (!ow) return -ENOMEM;
+        if (copy_from_user(ow->container_name, uarg, VARSER_MAX_CONTAINER_NAME)) {
+            kfree(ow);
+            return -EFAULT;
+        }
+        ow->container_name[VARSER_MAX_CONTAINER_NAME-1] = '\0';
+
+        mutex_lock(&global_list_lock);
+        c = find_container_locked(ow->container_name);
+        if (c) kref_get(&c->refcount);
+        mutex_unlock(&global_list_lock);
+        if (!c) {
+            kfree(ow);
+            return -ENOENT;
+        }
+        mutex_lock(&c->container_lock);
+        list_for_each_entry(o, &c->owners, list) {
+            if (i >= VARSER_MAX_OWNERS) break;
+            ow->owners[i].pid = o->pid;
+            memcpy(ow->owners[i].comm, o->comm, sizeof(ow->owners[i].comm));
+            ow->owners[i].opened_ns = o->opened_ns;
+            ++i;
+        }
+        ow->count = c->owner_count;
+        mutex_unlock(&c->container_lock);
+        ow->map_count = atomic_read(&c->map_count);
+        ow->refcount = kref_read(&c->refcount) - 1;
+        kref_put(&c->refcount, varser_container_release);
+
+        if (copy_to_user(uarg, ow, sizeof(*ow))) ret = -EFAULT;
+        kfree(ow);
+        return ret;
+    }
+    case VARSER_IOCTL_RESET_DEFAULTS:
     {
         struct varser_container *c = file->private_data;
+        struct varser_wait w;
         if (!c) return -EINVAL;
-        file->private_data = NULL;
-        kref_put(&c->refcount, varser_container_release);
+        varser_wait_init(&w, file, 0, 0);
+        return varser_reset_defaults(c, &w);
+    }
+    case VARSER_IOCTL_COMMIT:
+    {
+        struct varser_commit cm;
+        struct varser_container *c = file->private_data;
+        struct varser_wait w;
+        int ret;
+
+        if (copy_from_user(&cm, uarg, sizeof(cm))) return -EFAULT;
+        if (!c) return -EINVAL;
+        cm.conflict_index = 0;
+        varser_wait_init(&w, file, 0, 0);
+        ret = varser_commit(c, &cm, &w);
+        if (ret == -VARSER_COMMIT_CONFLICT &&
+            copy_to_user(uarg, &cm, sizeof(cm)))
+            return -EFAULT;
+        return ret;
+    }
+    case VARSER_IOCTL_STAT:
+    {
+        struct varser_stat *st;
+        struct varser_container *c = file->private_data;
+        int ret = 0;
+
+        if (!c) return -EINVAL;
+        st = kmalloc(sizeof(*st), GFP_KERNEL);
+        if (!st) return -ENOMEM;
+        varser_fill_stat(c, st);
+        if (copy_to_user(uarg, st, sizeof(*st))) ret = -EFAULT;
+        kfree(st);
+        return ret;
+    }
+    case VARSER_IOCTL_READ_HISTORY:
+    {
+        struct varser_history_read hr;
+        struct varser_container *c = file->private_data;
+        struct varser_var *v;
+        struct varser_wait w;
+        int ret;
+
+        if (copy_from_user(&hr, uarg, sizeof(hr))) return -EFAULT;
+        if (!c) return -EINVAL;
+        hr.var_name[VARSER_MAX_VAR_NAME-1] = '\0';
+        v = find_var(c, hr.var_name);
+        if (!v) return -ENOENT;
+        varser_wait_init(&w, file, 0, 0);
+        /* the ring is rewritten under the writer lock: under lock_policy none, where
+         * plain readers go unlocked, history readers still take v->rw
+         */
+        if (c->lock_policy == VARSER_LOCK_NONE) ret = varser_var_down_read(c, v, &w);
+        else ret = varser_lock_var(c, v, 0, &w);
+        if (ret) return ret;
+        ret = varser_history_read(v, &hr);
+        if (c->lock_policy == VARSER_LOCK_NONE) varser_var_up(v, 0);
+        else varser_unlock_var(c, v, 0);
+        if (ret) return ret;
+        if (copy_to_user(uarg, &hr, sizeof(hr))) return -EFAULT;
         return 0;
     }
     case VARSER_IOCTL_GET:
@@ -173,41 +1319,58 @@ static long varser_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
         struct varser_var_access access;
         struct varser_container *c = file->private_data;
         struct varser_var *v;
-        int found = 0;
+        struct varser_wait w;
 
         if (copy_from_user(&access, uarg, sizeof(access))) return -EFAULT;
         if (!c) return -EINVAL;
-        /* find variable under container lock */
-        mutex_lock(&c->container_lock);
-        list_for_each_entry(v, &c->vars, list) {
-            if (strncmp(v->name, access.var_name, VARSER_MAX_VAR_NAME) == 0) { found = 1; break; }
-        }
-        mutex_unlock(&c->container_lock);
-        if (!found) return -ENOENT;
+        v = find_var(c, access.var_name);
+        if (!v) return -ENOENT;
+        varser_wait_init(&w, file, access.flags, access.timeout_ms);
 
         if (cmd == VARSER_IOCTL_GET) {
-            /* read lock */
-            down_read(&v->rw);
-            if (access.buf_size < v->size) { up_read(&v->rw); return -EINVAL; }
-            if (access.user_buf == 0) { up_read(&v->rw); return -EINVAL; }
-            if (copy_to_user((void __user *)((uintptr_t)access.user_buf), v->data, v->size)) {
-                up_read(&v->rw);
-                return -EFAULT;
-            }
-            up_read(&v->rw);
-            return 0;
-        } else {
-            /* set */
-            down_write(&v->rw);
-            if (access.buf_size < v->size) { up_write(&v->rw); return -EINVAL; }
-            if (access.user_buf == 0) { up_write(&v->rw); return -EINVAL; }
-            if (copy_from_user(v->data, (void __user *)((uintptr_t)access.user_buf), v->size)) {
-                up_write(&v->rw);
+            u64 version;
+            u32 status;
+            int ret = varser_var_get(c, v, access.user_buf, access.buf_size, &version, &status, &w);
+            if (ret) return ret;
+            if (put_user(version, &((struct varser_var_access __user *)uarg)->version) ||
+                put_user(status, &((struct varser_var_access __user *)uarg)->status))
                 return -EFAULT;
-            }
-            up_write(&v->rw);
             return 0;
         }
+        return varser_var_set(c, v, access.user_buf, access.buf_size, &w);
+    }
+    case VARSER_IOCTL_SET_BATCH:
+    {
+        struct varser_batch batch;
+        struct varser_batch_entry *entries;
+        struct varser_container *c = file->private_data;
+        struct varser_wait w;
+        unsigned i;
+        int ret = 0;
+
+        if (copy_from_user(&batch, uarg, sizeof(batch))) return -EFAULT;
+        if (!c) return -EINVAL;
+        if (batch.count == 0) return 0;
+        if (batch.count > VARSER_MAX_VARS || batch.entries == 0) return -EINVAL;
+
+        entries = kmalloc_array(batch.count, sizeof(*entries), GFP_KERNEL);
+        if (!entries) return -ENOMEM;
+        if (copy_from_user(entries, (void __user *)((uintptr_t)batch.entries),
+                           batch.count * sizeof(*entries))) {
+            kfree(entries);
+            return -EFAULT;
+        }
+        varser_wait_init(&w, file, 0, 0);
+        for (i = 0; i < batch.count; ++i) {
+            struct varser_var *v;
+            entries[i].var_name[VARSER_MAX_VAR_NAME-1] = '\0';
+            v = find_var(c, entries[i].var_name);
+            if (!v) { ret = -ENOENT; break; }
+            ret = varser_var_set(c, v, entries[i].user_buf, entries[i].buf_size, &w);
+            if (ret) break;
+        }
+        kfree(entries);
+        return ret;
     }
     case VARSER_IOC_LIST_CONTAINERS:
     {
@@ -237,11 +1400,99 @@ static int varser_open(struct inode *inode, struct file *file)
 
 static int varser_release(struct inode *inode, struct file *file)
 {
-    struct varser_container *c = file->private_data;
-    if (c) {
-        file->private_data = NULL;
-        kref_put(&c->refcount, varser_container_release);
+    varser_detach(file);
+    return 0;
+}
+
+/* mmap of a pinned container: read-only, the mapping holds a container reference */
+static struct varser_var *varser_var_at(struct varser_container *c, u64 off)
+{
+    struct varser_var *v;
+    mutex_lock(&c->container_lock);
+    list_for_each_entry(v, &c->vars, list) {
+        if (off >= v->map_off && off - v->map_off < (u64)varser_var_nr_pages(v) * PAGE_SIZE) {
+            mutex_unlock(&c->container_lock);
+            return v;
+        }
     }
+    mutex_unlock(&c->container_lock);
+    return NULL;
+}
+
+static vm_fault_t varser_vm_fault(struct vm_fault *vmf)
+{
+    struct varser_container *c = vmf->vma->vm_private_data;
+    u64 off = (u64)vmf->pgoff << PAGE_SHIFT;
+    struct varser_var *v;
+
+    if (off < PAGE_SIZE)
+        return vmf_insert_pfn(vmf->vma, vmf->address, page_to_pfn(c->status_page));
+    v = varser_var_at(c, off);
+    if (!v) return VM_FAULT_SIGBUS; /* alignment gap between variables */
+    return vmf_insert_pfn(vmf->vma, vmf->address,
+                          page_to_pfn(v->pages[(off - v->map_off) >> PAGE_SHIFT]));
+}
+
+#ifdef VARSER_HUGE_FAULT
+static vm_fault_t varser_vm_huge_fault(struct vm_fault *vmf, unsigned int order)
+{
+    struct vm_area_struct *vma = vmf->vma;
+    struct varser_container *c = vma->vm_private_data;
+    unsigned long haddr = vmf->address & HPAGE_PMD_MASK;
+    struct varser_var *v;
+    unsigned long i;
+    u64 off;
+
+    if (order != HPAGE_PMD_ORDER) return VM_FAULT_FALLBACK;
+    if (haddr < vma->vm_start || haddr + HPAGE_PMD_SIZE > vma->vm_end) return VM_FAULT_FALLBACK;
+    off = ((u64)vma->vm_pgoff << PAGE_SHIFT) + (haddr - vma->vm_start);
+    v = varser_var_at(c, off);
+    if (!v || !IS_ALIGNED(off - v->map_off, HPAGE_PMD_SIZE)) return VM_FAULT_FALLBACK;
+    i = (off - v->map_off) >> PAGE_SHIFT;
+    if (!test_bit(i / VARSER_HUGE_NR, v->huge)) return VM_FAULT_FALLBACK; /* got single pages */
+    return vmf_insert_pfn_pmd(vmf, varser_pmd_pfn(page_to_pfn(v->pages[i])), false);
+}
+#endif
+
+static void varser_vm_open(struct vm_area_struct *vma)
+{
+    struct varser_container *c = vma->vm_private_data;
+    kref_get(&c->refcount);
+    atomic_inc(&c->map_count);
+}
+
+static void varser_vm_close(struct vm_area_struct *vma)
+{
+    struct varser_container *c = vma->vm_private_data;
+    atomic_dec(&c->map_count);
+    kref_put(&c->refcount, varser_container_release);
+}
+
+static const struct vm_operations_struct varser_vm_ops = {
+    .open = varser_vm_open,
+    .close = varser_vm_close,
+    .fault = varser_vm_fault,
+#ifdef VARSER_HUGE_FAULT
+    .huge_fault = varser_vm_huge_fault,
+#endif
+};
+
+static int varser_mmap(struct file *file, struct vm_area_struct *vma)
+{
+    struct varser_container *c = file->private_data;
+    u64 off = (u64)vma->vm_pgoff << PAGE_SHIFT;
+
+    if (!c) return -EINVAL;
+    if (!c->map_size) return -ENODEV;
+    if (vma->vm_flags & VM_WRITE) return -EPERM; /* writes go through SET/COMMIT */
+    if (off > c->map_size || vma->vm_end - vma->vm_start > c->map_size - off) return -EINVAL;
+    vm_flags_clear(vma, VM_MAYWRITE);
+    /* VM_HUGEPAGE: PMD faults also with THP in "madvise" mode */
+    vm_flags_set(vma, VM_PFNMAP | VM_DONTEXPAND | VM_DONTDUMP | VM_HUGEPAGE);
+    vma->vm_ops = &varser_vm_ops;
+    vma->vm_private_data = c;
+    kref_get(&c->refcount);
+    atomic_inc(&c->map_count);
     return 0;
 }
 
@@ -250,6 +1501,10 @@ static const struct file_operations varser_fops = {
     .unlocked_ioctl = varser_ioctl,
     .open = varser_open,
     .release = varser_release,
+    .mmap = varser_mmap,
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+    .get_unmapped_area = thp_get_unmapped_area, /* 2 MB aligned addresses */
+#endif
 };
 
 static struct miscdevice varser_misc = {
@@ -273,13 +1528,15 @@ static void __exit varser_exit(void)
 {
     misc_deregister(&varser_misc);
 
-    /* try to free all containers (if any remain) */
+    /* no fd or mapping can be left once the module is unloading: only registration
+     * references remain. release unlinks the container and takes global_list_lock itself.
+     */
     mutex_lock(&global_list_lock);
     while (!list_empty(&container_list)) {
         struct varser_container *c = list_first_entry(&container_list, struct varser_container, list);
-        list_del(&c->list);
-        /* force release */
+        mutex_unlock(&global_list_lock);
         varser_container_release(&c->refcount);
+        mutex_lock(&global_list_lock);
     }
     mutex_unlock(&global_list_lock);
 
@@ -24,6 +24,8 @@ typedef uint64_t u64;
 #define VARSER_MAX_VAR_NAME        64
 #define VARSER_MAX_CONTAINER_NAME  256
 #define VARSER_MAX_VARS            128
+#define VARSER_DEFAULT_VAR_SIZE    8   /* storage for variables declared without size */
+#define VARSER_MAX_HISTORY         65536
 
 /* Variable types */
 #define VARSER_TYPE_INT32   1
@@ -35,29 +37,185 @@ typedef uint64_t u64;
 #define VARSER_TYPE_STRING  7
 #define VARSER_TYPE_BLOB    8
 
+/* Lock policies (YAML lock_policy); a zero-filled REGISTER gets the per-variable locks.
+ * VARSER_LOCK_NONE only drops reader/writer isolation: readers take no lock and may see
+ * a write in progress, writers of a variable are still serialized in the kernel.
+ */
+#define VARSER_LOCK_VARIABLE_RW       0
+#define VARSER_LOCK_CONTAINER_MUTEX   1
+#define VARSER_LOCK_NONE              2
+#define VARSER_LOCK_MAX               VARSER_LOCK_NONE
+
+/* Lock preference for per_variable_rw (YAML lock_preference) */
+#define VARSER_PREFER_READERS  0 /* plain rw semaphore */
+#define VARSER_PREFER_WRITERS  1 /* new readers wait while a writer is queued */
+
+/* varser_var_access.flags; O_NONBLOCK on the fd acts like VARSER_ACCESS_NONBLOCK */
+#define VARSER_ACCESS_NONBLOCK  0x01 /* fail with EAGAIN instead of waiting for the lock */
+#define VARSER_ACCESS_TIMEOUT   0x02 /* fail with ETIMEDOUT after timeout_ms */
+
+/* Container flags (varser_register.flags) */
+#define VARSER_REG_F_HUGE_PAGES  0x01 /* mmap-able storage on 2 MB pages where possible (YAML huge_pages) */
+
+/* Value status (varser_var_access.status, varser_map_status.status).
+ * Cleared by the next complete write of the variable.
+ */
+#define VARSER_STATUS_TORN        0x01 /* last write stopped midway: value is part old, part new */
+#define VARSER_STATUS_OWNER_DIED  0x02 /* the writer was killed during that write */
+
 /* Data structures passed via ioctl (packed layout assumptions) */
+/* Variable flags */
+#define VARSER_VAR_F_DEFAULT  0x01 /* has a default value in the initial image */
+
 struct varser_var_desc {
     char name[VARSER_MAX_VAR_NAME];
     u8   type;    /* VARSER_TYPE_* */
     u32  size;    /* for string/blob */
-    u8   reserved[3];
+    u8   flags;   /* VARSER_VAR_F_* */
+    u8   reserved[2];
+    u32  history; /* depth of the history ring, 0 = no history, at most VARSER_MAX_HISTORY (YAML history: N) */
+    u64  map_offset; /* out (GET_SCHEMA): offset of the value in the container mmap */
 };
 
+/* Used both for REGISTER and as the schema returned by GET_SCHEMA.
+ *
+ * Initial image: values of all VARSER_VAR_F_DEFAULT variables packed back to back
+ * in declaration order, each taking the variable's full storage size.
+ * REGISTER: image/image_size describe the image to copy in.
+ * GET_SCHEMA: the image is copied out if image_size is large enough;
+ *             image_size always returns the required size.
+ */
 struct varser_register {
     char container_name[VARSER_MAX_CONTAINER_NAME];
     u32  var_count;
-    u8   reserved[4];
+    u8   lock_policy; /* VARSER_LOCK_* */
+    u8   lock_pref;   /* VARSER_PREFER_* */
+    u8   flags;       /* VARSER_REG_F_* */
+    u8   reserved[1];
     struct varser_var_desc vars[VARSER_MAX_VARS];
+    u64  image_size;
+    unsigned long image; /* uintptr_t: pointer to user-space initial image */
 };
 
 struct varser_var_access {
     char container_name[VARSER_MAX_CONTAINER_NAME];
+    char var_name[VARSER_MAX_VAR_NAME];
+    u32  buf_size;      /* size of user buffer in bytes */
+    u32  flags;         /* VARSER_ACCESS_* */
+    unsigned long user_buf; /* uintptr_t: pointer to user-space buffer */
+    u64  version;       /* out (GET): version of the value read, bumped by every write */
+    u32  timeout_ms;    /* with VARSER_ACCESS_TIMEOUT */
+    u32  status;        /* out (GET): VARSER_STATUS_* of the value read */
+};
+
+/* Batched SET: applies several variables in one syscall.
+ * Each entry is applied under its own variable lock; the batch is not atomic as a whole.
+ */
+struct varser_batch_entry {
     char var_name[VARSER_MAX_VAR_NAME];
     u32  buf_size;      /* size of user buffer in bytes */
     u8   reserved[4];
     unsigned long user_buf; /* uintptr_t: pointer to user-space buffer */
 };
 
+struct varser_batch {
+    u32  count;         /* number of entries, at most VARSER_MAX_VARS */
+    u8   reserved[4];
+    unsigned long entries; /* uintptr_t: pointer to struct varser_batch_entry[count] */
+};
+
+/* Transaction commit (optimistic concurrency).
+ * All reads are validated against the current variable versions and all writes are
+ * applied while holding every involved lock (taken in declaration order).
+ * Writes reuse struct varser_batch_entry.
+ */
+#define VARSER_COMMIT_CONFLICT  ESTALE /* errno of COMMIT when a read version is stale */
+
+struct varser_tx_read {
+    char var_name[VARSER_MAX_VAR_NAME];
+    u64  version;       /* version observed by GET */
+};
+
+struct varser_commit {
+    u32  read_count;    /* at most VARSER_MAX_VARS */
+    u32  write_count;   /* at most VARSER_MAX_VARS */
+    unsigned long reads;  /* uintptr_t: pointer to struct varser_tx_read[read_count] */
+    unsigned long writes; /* uintptr_t: pointer to struct varser_batch_entry[write_count] */
+    u32  conflict_index; /* out: first stale entry in reads on VARSER_COMMIT_CONFLICT */
+    u8   reserved[4];
+};
+
+/* mmap of an opened VARSER_REG_F_HUGE_PAGES container: read-only view of all values,
+ * each at its varser_var_desc.map_offset. Reads through the mapping take no locks.
+ * Variables with whole 2 MB chunks start 2 MB aligned and those chunks are mapped
+ * with huge PMD entries when the kernel got 2 MB pages for them (see huge_bytes).
+ *
+ * The first page holds one varser_map_status per variable (declaration order).
+ * seq is odd while the kernel writes the value: read seq, copy the value, then
+ * retry if seq was odd or has changed. seq is only changed by the kernel, under the
+ * variable's writer lock (held under every lock policy), so it can't be left odd by a
+ * process that dies.
+ */
+struct varser_map_status {
+    u64  seq;
+    u32  status;        /* VARSER_STATUS_* */
+    u8   reserved[4];
+};
+
+/* Memory usage of the opened container. Large variables are allocated page by page
+ * on first write, so resident can be far below declared.
+ */
+struct varser_stat {
+    u32  var_count;
+    u8   reserved[4];
+    u64  declared_bytes;
+    u64  resident_bytes;
+    u64  map_size;      /* length of the container mmap, 0 = can't be mapped */
+    u64  huge_bytes;    /* part of resident_bytes on 2 MB pages */
+    u64  var_resident[VARSER_MAX_VARS]; /* per variable, declaration order */
+};
+
+/* History ring: the last N values of a variable with their version and timestamp.
+ * READ_HISTORY returns, oldest first, every kept value with version > since_version.
+ * Each returned entry is entry_size bytes: struct varser_history_entry + the value.
+ */
+struct varser_history_entry {
+    u64  version;
+    u64  timestamp_ns;  /* CLOCK_MONOTONIC at the write */
+};
+
+struct varser_history_read {
+    char var_name[VARSER_MAX_VAR_NAME];
+    u64  since_version;
+    u32  max_entries;   /* capacity of user_buf in entries */
+    u32  entry_size;    /* out: sizeof(struct varser_history_entry) + variable size */
+    unsigned long user_buf; /* uintptr_t: pointer to max_entries * entry_size bytes */
+    u32  count;         /* out: entries returned */
+    u8   reserved[4];
+    u64  dropped;       /* out: versions after since_version already overwritten in the ring */
+};
+
+/* Who keeps a container alive: every fd that opened it, plus live mappings.
+ * Looked up by name, the caller doesn't need to open the container.
+ */
+#define VARSER_MAX_OWNERS  64
+
+struct varser_owner_info {
+    u32  pid;           /* thread group of the process that opened the fd */
+    char comm[16];      /* TASK_COMM_LEN */
+    u8   reserved[4];
+    u64  opened_ns;     /* CLOCK_MONOTONIC time of OPEN_CONTAINER */
+};
+
+struct varser_owners {
+    char container_name[VARSER_MAX_CONTAINER_NAME];
+    u32  count;         /* out: open fds, owners[] holds the first VARSER_MAX_OWNERS */
+    u32  map_count;     /* out: live mappings */
+    u32  refcount;      /* out: references besides this query (registration included) */
+    u8   reserved[4];
+    struct varser_owner_info owners[VARSER_MAX_OWNERS];
+};
+
 /* IOCTL numbers (both descriptive and compatibility aliases)
  *
  * We define VARSER_IOCTL_* names and also alias old VARSER_IOC_* names so existing code compiles.
@@ -72,6 +230,15 @@ struct varser_var_access {
 #define VARSER_IOCTL_OPEN_CONTAINER   _IOW(VARSER_IOCTL_MAGIC, 4, char[VARSER_MAX_CONTAINER_NAME])
 #define VARSER_IOCTL_CLOSE_CONTAINER  _IO(VARSER_IOCTL_MAGIC, 5)
 #define VARSER_IOCTL_LIST_CONTAINERS  _IOR(VARSER_IOCTL_MAGIC, 6, char[4096])
+#define VARSER_IOCTL_SET_BATCH        _IOW(VARSER_IOCTL_MAGIC, 7, struct varser_batch)
+/* in: container_name, out: the schema stored at REGISTER */
+#define VARSER_IOCTL_GET_SCHEMA       _IOWR(VARSER_IOCTL_MAGIC, 8, struct varser_register)
+/* rewrite all variables of the opened container with their defaults */
+#define VARSER_IOCTL_RESET_DEFAULTS   _IO(VARSER_IOCTL_MAGIC, 9)
+#define VARSER_IOCTL_COMMIT           _IOWR(VARSER_IOCTL_MAGIC, 10, struct varser_commit)
+#define VARSER_IOCTL_STAT             _IOR(VARSER_IOCTL_MAGIC, 11, struct varser_stat)
+#define VARSER_IOCTL_READ_HISTORY     _IOWR(VARSER_IOCTL_MAGIC, 12, struct varser_history_read)
+#define VARSER_IOCTL_LIST_OWNERS      _IOWR(VARSER_IOCTL_MAGIC, 13, struct varser_owners)
 
 /* Алиасы для старого кода */
 #define VARSER_IOC_MAGIC           VARSER_IOCTL_MAGIC
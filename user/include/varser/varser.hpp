@@ -3,6 +3,8 @@
 #include <vector>
 #include <memory>
 #include <cstdint>
+#include <cstddef>
+#include <chrono>
 
 namespace varser {
 
@@ -14,22 +16,111 @@ struct VarDesc {
     std::string name;
     VarType type;
     uint32_t size{0}; // for string/blob
+    std::vector<uint8_t> default_value; // encoded YAML default (storage size), empty = zeros
+    uint32_t history{0}; // kernel keeps this many past values, 0 = none
 };
 
 struct ContainerDesc {
     std::string name;
     std::string lock_policy;
+    std::string lock_preference{"reader"}; // per_variable_rw: "reader" or "writer"
+    bool huge_pages{false}; // mmap-able storage on 2 MB pages where the kernel can get them
     std::vector<VarDesc> vars;
 };
 
+// Write-behind: set() only updates a local shadow copy, dirty variables are
+// pushed to the kernel as one batched update.
+struct WriteBehindOptions {
+    std::chrono::milliseconds interval{5}; // periodic flush interval, must be positive
+    size_t dirty_threshold{0};             // flush once this many variables are dirty (0 = off)
+};
+
+class Container;
+
+// Memory usage reported by the kernel
+struct ContainerStats {
+    uint64_t declared_bytes{0};
+    uint64_t resident_bytes{0};         // large variables are allocated on first write
+    std::vector<uint64_t> var_resident; // per variable, declaration order
+    uint64_t map_size{0};   // huge_pages containers: length of the read-only mapping
+    uint64_t huge_bytes{0}; // resident bytes that actually sit on 2 MB pages
+};
+
+// One past value from a variable's history ring
+struct HistoryEntry {
+    uint64_t version;
+    uint64_t timestamp_ns; // CLOCK_MONOTONIC time of the write
+    std::vector<uint8_t> value;
+};
+
+// Status of a value as reported by the kernel; cleared by the next complete write
+struct ValueStatus {
+    uint64_t version{0};
+    bool torn{false};       // last write stopped midway: value is part old, part new
+    bool owner_died{false}; // the writer was killed during that write
+};
+
+// Processes that keep a container alive
+struct OwnerInfo {
+    uint32_t pid;
+    std::string comm;
+    uint64_t opened_ns; // CLOCK_MONOTONIC
+};
+
+struct ContainerOwners {
+    std::vector<OwnerInfo> fds; // first 64 open fds
+    uint32_t open_count{0};     // all open fds
+    uint32_t map_count{0};      // live mappings
+    uint32_t refcount{0};       // kernel references, registration included
+};
+
+enum class CommitResult {
+    Ok,       // all writes applied atomically
+    Conflict, // a variable read by the transaction changed meanwhile, nothing applied
+    Error
+};
+
+// Optimistic multi-variable transaction: reads record the version they saw,
+// writes are buffered; commit() validates and applies everything in one ioctl.
+class Transaction {
+public:
+    template<typename T>
+    bool get(const std::string &varname, T &out);
+
+    template<typename T>
+    void set(const std::string &varname, const T &value);
+
+    bool get_bytes(const std::string &varname, void *data, size_t size);
+    void set_bytes(const std::string &varname, const void *data, size_t size);
+
+    // On Conflict start a new transaction and retry
+    CommitResult commit();
+
+private:
+    friend class Container;
+    explicit Transaction(Container &owner): c(owner) {}
+
+    struct Read {
+        std::string name;
+        uint64_t version;
+    };
+    struct Write {
+        std::string name;
+        std::vector<uint8_t> value;
+    };
+    Container &c;
+    std::vector<Read> reads;
+    std::vector<Write> writes;
+};
+
 class Container {
 public:
     Container(ContainerDesc desc);
     ~Container();
 
-    bool register_with_kernel(); // calls IOCTL REGISTER
+    bool register_with_kernel(); // calls IOCTL REGISTER, verifies schema if container exists
     bool open(); // OPEN_CONTAINER
-    bool close(); // CLOSE_CONTAINER
+    bool close(); // CLOSE_CONTAINER; false if pending write-behind values could not be flushed
 
     template<typename T>
     bool set(const std::string &varname, const T &value);
@@ -37,9 +128,64 @@ public:
     template<typename T>
     bool get(const std::string &varname, T &out);
 
+    // Bounded access: false with errno EAGAIN (lock busy) or ETIMEDOUT (deadline passed)
+    template<typename T>
+    bool try_get(const std::string &varname, T &out);
+
+    // Deadline waits retry whenever the lock is released but don't queue on the lock,
+    // so under contention they can lose to blocking get/set calls until the timeout
+    template<typename T>
+    bool get_for(const std::string &varname, T &out, std::chrono::milliseconds timeout);
+
+    template<typename T>
+    bool try_set(const std::string &varname, const T &value);
+
+    template<typename T>
+    bool set_for(const std::string &varname, const T &value, std::chrono::milliseconds timeout);
+
+    // Raw access for string/blob variables; size must cover the declared variable size
+    bool set_bytes(const std::string &varname, const void *data, size_t size);
+    bool get_bytes(const std::string &varname, void *data, size_t size);
+
+    bool enable_write_behind(const WriteBehindOptions &opts = {});
+    bool disable_write_behind(); // flushes pending values; on failure stays enabled and keeps retrying
+    bool flush(); // SET_BATCH of all dirty variables
+
+    // Pending write-behind values are flushed here, before each kernel read and before commit
+    Transaction transaction();
+
+    // Rewrites every variable with its YAML default in one ioctl
+    // (pending write-behind values are discarded)
+    bool reset_to_defaults();
+
+    const ContainerDesc &desc() const;
+    bool stats(ContainerStats &out);
+
+    // Values written after since_version, oldest first (variable needs history: N).
+    // dropped receives how many newer versions already fell out of the ring.
+    bool read_history(const std::string &varname, uint64_t since_version,
+                      std::vector<HistoryEntry> &out, uint64_t *dropped = nullptr);
+
+    // huge_pages containers: pointer to the value inside a read-only mapping of the
+    // whole container (mapped on first use). Reads take no locks, so a value can be
+    // torn while a writer updates it. nullptr on failure.
+    const void *mapped(const std::string &varname);
+    void unmap();
+
+    // Like get_bytes, also reports whether the value was torn by a failed write
+    bool get_checked(const std::string &varname, void *data, size_t size, ValueStatus &status);
+    // Consistent copy through the mapping without taking kernel locks; falls back to
+    // get_checked while a writer keeps the value busy
+    bool read_mapped(const std::string &varname, void *data, size_t size, ValueStatus &status);
+
 private:
-    bool container_exists(); // Добавьте эту строку
-    
+    friend class Transaction;
+    bool get_versioned(const std::string &varname, void *data, size_t size, ValueStatus &status,
+                       uint32_t flags = 0, uint32_t timeout_ms = 0);
+    bool get_mode(const std::string &varname, void *data, size_t size, uint32_t flags, uint32_t timeout_ms,
+                  ValueStatus *status = nullptr);
+    bool set_mode(const std::string &varname, const void *data, size_t size, uint32_t flags, uint32_t timeout_ms);
+
     struct Impl;
     std::unique_ptr<Impl> p;
 };
@@ -48,6 +194,10 @@ class ContainerManager {
 public:
     static ContainerManager &instance();
     std::shared_ptr<Container> load_from_yaml(const std::string &path);
+    // Builds a Container from the schema stored in the kernel (no YAML needed)
+    std::shared_ptr<Container> attach(const std::string &name);
+    // Open fds and mappings of a container (LIST_OWNERS), no need to open it
+    bool owners(const std::string &name, ContainerOwners &out);
 private:
     ContainerManager();
 };
@@ -18,10 +18,18 @@ int main(int argc, char** argv) {
     
     using namespace varser;
     
-    std::string yamlPath = (argc > 1) ? argv[1] : "../examples/container.yaml.example";
-    std::cout << "Reader: Using YAML file: " << yamlPath << std::endl << std::flush;
+    // Аргумент: путь к YAML или имя уже зарегистрированного контейнера
+    std::string source = (argc > 1) ? argv[1] : "../examples/container.yaml.example";
+    bool is_yaml = source.ends_with(".yaml") || source.ends_with(".yml") || source.ends_with(".example");
     
-    auto c = ContainerManager::instance().load_from_yaml(yamlPath);
+    std::shared_ptr<Container> c;
+    if (is_yaml) {
+        std::cout << "Reader: Using YAML file: " << source << std::endl << std::flush;
+        c = ContainerManager::instance().load_from_yaml(source);
+    } else {
+        std::cout << "Reader: Attaching to container: " << source << std::endl << std::flush;
+        c = ContainerManager::instance().attach(source);
+    }
     if (!c) { 
         std::cerr << "Reader: Load failed\n" << std::flush; 
         return 1; 
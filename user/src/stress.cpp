@@ -0,0 +1,417 @@
+// varser_stress: multi-process stress / scalability harness.
+//
+// Forks writer, reader and read-modify-write processes against one container as
+// described by a YAML scenario, records a timestamped history of every operation
+// and checks it offline:
+//   * torn reads: every written value is one 64-bit word (tag<<32 | tag) repeated
+//     over the whole variable, a reader that sees mixed words saw a torn value;
+//   * linearizability of each variable as a register with unique writes
+//     (Gibbons-Korach zone check: no read precedes its write, no two forward
+//     zones overlap, no backward zone lies inside a forward zone);
+//   * RMW transactions: committed increments form one gap-free chain.
+// Failed operations (other than commit conflicts) and failed workers fail the run.
+// Throughput is reported for every process count in the scenario.
+#include "varser/varser.hpp"
+#include <yaml-cpp/yaml.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace varser;
+
+namespace {
+
+enum class Role : uint32_t { WRITER, READER, RMW };
+
+enum OpKind : uint32_t { OP_WRITE = 1, OP_READ = 2, OP_COMMIT = 3, OP_ERROR = 4 };
+
+// one history record, written raw to <history_dir>/step<N>_proc<i>.bin
+struct OpRecord {
+    uint64_t start_ns;
+    uint64_t end_ns;
+    uint64_t value;   // tag for WRITE/READ, counter value read by COMMIT
+    uint32_t var;     // index in scenario variables
+    uint32_t kind;    // OpKind
+    uint32_t proc;
+    uint32_t torn;    // READ saw inconsistent words
+};
+
+struct Scenario {
+    ContainerDesc desc;
+    std::vector<int> processes;
+    uint32_t duration_ms{2000};
+    double writer_share{1}, reader_share{2}, rmw_share{1};
+    std::string rmw_var;  // int64 counter driven by transactions, excluded from writers/readers
+    std::string history_dir{"/tmp/varser_stress"};
+};
+
+uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+size_t storage_size(const VarDesc &vd) {
+    return vd.size ? vd.size : 8; // matches VARSER_DEFAULT_VAR_SIZE
+}
+
+VarType parse_type(const std::string &t) {
+    if (t == "int32") return VarType::INT32;
+    if (t == "int64") return VarType::INT64;
+    if (t == "uint8") return VarType::UINT8;
+    if (t == "uint64") return VarType::UINT64;
+    if (t == "float") return VarType::FLOAT;
+    if (t == "double") return VarType::DOUBLE;
+    if (t == "string") return VarType::STRING;
+    if (t == "blob") return VarType::BLOB;
+    throw std::runtime_error("unknown type " + t);
+}
+
+Scenario load_scenario(const std::string &path) {
+    YAML::Node root = YAML::LoadFile(path);
+    Scenario sc;
+    sc.desc.name = root["container"].as<std::string>("varser_stress");
+    sc.desc.lock_policy = root["lock_policy"].as<std::string>("per_variable_rw");
+    sc.desc.lock_preference = root["lock_preference"].as<std::string>("reader");
+    sc.duration_ms = root["duration_ms"].as<uint32_t>(2000);
+    sc.history_dir = root["history_dir"].as<std::string>(sc.history_dir);
+    sc.rmw_var = root["rmw_variable"].as<std::string>("");
+    if (root["processes"]) {
+        for (const auto &n : root["processes"]) sc.processes.push_back(n.as<int>());
+    } else {
+        sc.processes = {1, 2, 4, 8};
+    }
+    if (sc.processes.empty()) throw std::runtime_error("no process counts");
+    for (int n : sc.processes) {
+        if (n < 1 || n > 255) throw std::runtime_error("process count must be 1..255"); // 8-bit proc in tags
+    }
+    if (const auto &mix = root["mix"]) {
+        sc.writer_share = mix["writer"].as<double>(0);
+        sc.reader_share = mix["reader"].as<double>(0);
+        sc.rmw_share = mix["rmw"].as<double>(0);
+    }
+    for (const auto &n : root["variables"]) {
+        VarDesc vd;
+        vd.name = n["name"].as<std::string>();
+        vd.type = parse_type(n["type"].as<std::string>());
+        if (vd.type == VarType::STRING || vd.type == VarType::BLOB) vd.size = n["size"].as<uint32_t>(256);
+        sc.desc.vars.push_back(vd);
+    }
+    if (sc.desc.vars.empty()) throw std::runtime_error("scenario has no variables");
+    if (sc.rmw_share > 0 && sc.rmw_var.empty()) throw std::runtime_error("mix.rmw needs rmw_variable");
+    return sc;
+}
+
+// role of process i out of n, following the mix shares
+Role role_for(const Scenario &sc, int i, int n) {
+    double total = sc.writer_share + sc.reader_share + sc.rmw_share;
+    double x = (i + 0.5) / n * total;
+    if (x < sc.writer_share) return Role::WRITER;
+    if (x < sc.writer_share + sc.reader_share) return Role::READER;
+    return Role::RMW;
+}
+
+// tag: proc (8 bits) | sequence (24 bits); 0 is the initial (zeroed) value
+uint32_t make_tag(uint32_t proc, uint32_t seq) {
+    return (proc << 24) | (seq & 0xFFFFFF);
+}
+
+void fill_value(std::vector<uint8_t> &buf, uint32_t tag) {
+    uint64_t word = ((uint64_t)tag << 32) | tag;
+    for (size_t off = 0; off < buf.size(); off += sizeof(word))
+        memcpy(buf.data() + off, &word, std::min(sizeof(word), buf.size() - off));
+}
+
+// returns false if the words of buf disagree (torn value)
+bool decode_value(const std::vector<uint8_t> &buf, uint32_t &tag) {
+    uint64_t first = 0;
+    memcpy(&first, buf.data(), std::min(sizeof(first), buf.size()));
+    tag = (uint32_t)first;
+    if (buf.size() >= sizeof(first) && (uint32_t)(first >> 32) != tag) return false;
+    for (size_t off = sizeof(first); off < buf.size(); off += sizeof(first)) {
+        size_t n = std::min(sizeof(first), buf.size() - off);
+        if (memcmp(buf.data() + off, &first, n) != 0) return false;
+    }
+    return true;
+}
+
+std::string history_path(const Scenario &sc, int step, int proc) {
+    return sc.history_dir + "/step" + std::to_string(step) + "_proc" + std::to_string(proc) + ".bin";
+}
+
+// ---- worker process ----
+
+int run_worker(const Scenario &sc, int step, uint32_t proc, Role role, int start_fd) {
+    auto c = ContainerManager::instance().attach(sc.desc.name);
+    if (!c || !c->open()) return 2;
+
+    std::vector<uint32_t> plain; // variables for writers/readers
+    uint32_t rmw_idx = UINT32_MAX;
+    for (uint32_t i = 0; i < sc.desc.vars.size(); ++i) {
+        if (sc.desc.vars[i].name == sc.rmw_var) rmw_idx = i;
+        else plain.push_back(i);
+    }
+    if ((role == Role::RMW && rmw_idx == UINT32_MAX) || (role != Role::RMW && plain.empty())) return 2;
+
+    std::vector<std::vector<uint8_t>> bufs;
+    for (const auto &vd : sc.desc.vars) bufs.emplace_back(storage_size(vd));
+    std::vector<OpRecord> history;
+    history.reserve(1 << 16);
+    std::mt19937 gen(proc * 7919u + (uint32_t)step);
+    std::uniform_int_distribution<size_t> pick(0, plain.empty() ? 0 : plain.size() - 1);
+
+    // wait for the parent to release all workers at once
+    char go;
+    if (read(start_fd, &go, 1) < 0) return 2;
+    close(start_fd);
+
+    uint32_t seq = 0;
+    const uint64_t deadline = now_ns() + (uint64_t)sc.duration_ms * 1000000ull;
+    while (now_ns() < deadline) {
+        OpRecord r{};
+        r.proc = proc;
+        if (role == Role::RMW) {
+            auto tx = c->transaction();
+            int64_t counter = 0;
+            r.var = rmw_idx;
+            r.kind = OP_COMMIT;
+            r.start_ns = now_ns();
+            CommitResult res = CommitResult::Error;
+            if (tx.get<int64_t>(sc.rmw_var, counter)) {
+                tx.set<int64_t>(sc.rmw_var, counter + 1);
+                res = tx.commit();
+            }
+            r.end_ns = now_ns();
+            if (res == CommitResult::Conflict) continue; // expected, only commits matter
+            if (res == CommitResult::Error) r.kind = OP_ERROR;
+            r.value = (uint64_t)counter;
+        } else if (role == Role::WRITER) {
+            if (seq >= 0xFFFFFF) break; // tag space exhausted, stop writing
+            r.var = (uint32_t)plain[pick(gen)];
+            r.kind = OP_WRITE;
+            uint32_t tag = make_tag(proc, ++seq);
+            fill_value(bufs[r.var], tag);
+            r.start_ns = now_ns();
+            bool ok = c->set_bytes(sc.desc.vars[r.var].name, bufs[r.var].data(), bufs[r.var].size());
+            r.end_ns = now_ns();
+            if (!ok) r.kind = OP_ERROR;
+            r.value = tag;
+        } else {
+            r.var = (uint32_t)plain[pick(gen)];
+            r.kind = OP_READ;
+            r.start_ns = now_ns();
+            bool ok = c->get_bytes(sc.desc.vars[r.var].name, bufs[r.var].data(), bufs[r.var].size());
+            r.end_ns = now_ns();
+            if (!ok) {
+                r.kind = OP_ERROR;
+                history.push_back(r);
+                continue;
+            }
+            uint32_t tag = 0;
+            r.torn = decode_value(bufs[r.var], tag) ? 0 : 1;
+            r.value = tag;
+        }
+        history.push_back(r);
+    }
+    c->close();
+
+    FILE *f = fopen(history_path(sc, step, (int)proc).c_str(), "wb");
+    if (!f) return 2;
+    size_t written = fwrite(history.data(), sizeof(OpRecord), history.size(), f);
+    fclose(f);
+    return written == history.size() ? 0 : 2;
+}
+
+// ---- offline checker ----
+
+struct CheckResult {
+    uint64_t writes{0}, reads{0}, commits{0};
+    uint64_t errors{0}, torn{0}, unknown{0}, future{0}, overlaps{0}, nested{0}, rmw_errors{0};
+    uint64_t violations() const { return errors + torn + unknown + future + overlaps + nested + rmw_errors; }
+};
+
+// Zone of a cluster (a write and all reads of its value): from the earliest end to
+// the latest start. Forward if some op ended before another one started, backward otherwise.
+struct Zone {
+    uint64_t low, high;
+};
+
+// Gibbons-Korach: a register history with unique written values is linearizable iff no
+// read precedes its write, no two forward zones intersect and no backward zone lies
+// strictly inside a forward zone.
+void check_register(const std::vector<const OpRecord *> &ops, uint64_t step_start, CheckResult &res) {
+    struct Cluster {
+        const OpRecord *write;
+        uint64_t min_end, max_start;
+    };
+    // the zeroed value (tag 0) counts as a write completed at step start
+    OpRecord initial{};
+    initial.start_ns = initial.end_ns = step_start;
+    std::map<uint32_t, Cluster> clusters{{0, {&initial, initial.end_ns, initial.start_ns}}};
+    for (const OpRecord *op : ops) {
+        if (op->kind == OP_WRITE) clusters[(uint32_t)op->value] = {op, op->end_ns, op->start_ns};
+    }
+    for (const OpRecord *r : ops) {
+        if (r->kind != OP_READ) continue;
+        if (r->torn) { ++res.torn; continue; }
+        auto it = clusters.find((uint32_t)r->value);
+        if (it == clusters.end()) { ++res.unknown; continue; }
+        Cluster &cl = it->second;
+        if (r->end_ns < cl.write->start_ns) { ++res.future; continue; }
+        cl.min_end = std::min(cl.min_end, r->end_ns);
+        cl.max_start = std::max(cl.max_start, r->start_ns);
+    }
+
+    std::vector<Zone> forward, backward;
+    for (const auto &kv : clusters) {
+        const Cluster &cl = kv.second;
+        if (cl.min_end < cl.max_start) forward.push_back({cl.min_end, cl.max_start});
+        else backward.push_back({cl.max_start, cl.min_end});
+    }
+    auto by_low = [](const Zone &a, const Zone &b) { return a.low < b.low; };
+    std::sort(forward.begin(), forward.end(), by_low);
+
+    // forward zones must be pairwise disjoint
+    uint64_t reach = 0;
+    for (size_t i = 0; i < forward.size(); ++i) {
+        if (i && forward[i].low < reach) ++res.overlaps;
+        reach = std::max(reach, forward[i].high);
+    }
+    // a backward zone inside a forward zone: the cluster's value had to be both
+    // overwritten and still visible. Forward zones are disjoint when this matters,
+    // so the one starting last before the backward zone is the only candidate.
+    for (const Zone &b : backward) {
+        auto it = std::lower_bound(forward.begin(), forward.end(), Zone{b.low, 0}, by_low);
+        if (it == forward.begin()) continue;
+        --it;
+        if (it->low < b.low && b.high < it->high) ++res.nested;
+    }
+}
+
+void check_rmw(std::vector<const OpRecord *> commits, int64_t final_value, CheckResult &res) {
+    // every commit read a distinct value and the chain 0,1,2,... has no gaps
+    std::sort(commits.begin(), commits.end(), [](const OpRecord *a, const OpRecord *b) { return a->value < b->value; });
+    for (size_t i = 0; i < commits.size(); ++i) {
+        if (commits[i]->value != i) { ++res.rmw_errors; break; }
+    }
+    if (final_value != (int64_t)commits.size()) ++res.rmw_errors;
+}
+
+CheckResult check_step(const Scenario &sc, int step, int nproc, uint64_t step_start, int64_t rmw_final) {
+    std::vector<OpRecord> all;
+    for (int p = 1; p <= nproc; ++p) {
+        std::ifstream in(history_path(sc, step, p), std::ios::binary);
+        OpRecord r;
+        while (in.read(reinterpret_cast<char *>(&r), sizeof(r))) all.push_back(r);
+    }
+
+    CheckResult res;
+    std::vector<std::vector<const OpRecord *>> per_var(sc.desc.vars.size());
+    std::vector<const OpRecord *> commits;
+    for (const OpRecord &r : all) {
+        if (r.kind == OP_ERROR) { ++res.errors; continue; }
+        if (r.var >= per_var.size()) continue;
+        if (r.kind == OP_WRITE) ++res.writes;
+        if (r.kind == OP_READ) ++res.reads;
+        if (r.kind == OP_COMMIT) { ++res.commits; commits.push_back(&r); }
+        else per_var[r.var].push_back(&r);
+    }
+    for (const auto &ops : per_var) check_register(ops, step_start, res);
+    if (!sc.rmw_var.empty()) check_rmw(commits, rmw_final, res);
+    return res;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    std::string path = (argc > 1) ? argv[1] : "../examples/stress.yaml";
+    Scenario sc;
+    try {
+        sc = load_scenario(path);
+    } catch (const std::exception &e) {
+        std::cerr << "Stress: bad scenario " << path << ": " << e.what() << std::endl;
+        return 1;
+    }
+    mkdir(sc.history_dir.c_str(), 0755);
+
+    Container control(sc.desc);
+    if (!control.register_with_kernel() || !control.open()) {
+        std::cerr << "Stress: cannot register container " << sc.desc.name << std::endl;
+        return 1;
+    }
+
+    std::cout << "Stress: container " << sc.desc.name << ", lock_policy " << sc.desc.lock_policy
+              << ", " << sc.duration_ms << " ms per step\n";
+    std::cout << "procs  writers readers rmw     ops/s      writes     reads    commits  violations\n";
+
+    uint64_t total_violations = 0;
+    for (size_t step = 0; step < sc.processes.size(); ++step) {
+        int n = sc.processes[step];
+        // tags restart every step: values left from the previous one would alias them
+        if (!control.reset_to_defaults()) {
+            std::cerr << "Stress: cannot reset the container before step " << step << "\n";
+            std::cout << "Stress: FAILED\n";
+            return 1;
+        }
+
+        int start_pipe[2];
+        if (pipe(start_pipe) != 0) { perror("pipe"); return 1; }
+        int roles[3] = {0, 0, 0};
+        std::vector<pid_t> children;
+        fflush(stdout); // children must not inherit unflushed output
+        for (int i = 0; i < n; ++i) {
+            Role role = role_for(sc, i, n);
+            ++roles[(int)role];
+            pid_t pid = fork();
+            if (pid < 0) { perror("fork"); return 1; }
+            if (pid == 0) {
+                close(start_pipe[1]);
+                _exit(run_worker(sc, (int)step, (uint32_t)(i + 1), role, start_pipe[0]));
+            }
+            children.push_back(pid);
+        }
+        close(start_pipe[0]);
+        uint64_t step_start = now_ns();
+        close(start_pipe[1]); // EOF releases every worker
+
+        uint64_t failed = 0;
+        for (pid_t pid : children) {
+            int status = 0;
+            waitpid(pid, &status, 0);
+            if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) ++failed;
+        }
+        if (failed) std::cerr << "Stress: " << failed << " workers failed, their history is missing\n";
+
+        int64_t rmw_final = 0;
+        if (!sc.rmw_var.empty()) control.get<int64_t>(sc.rmw_var, rmw_final);
+        CheckResult res = check_step(sc, (int)step, n, step_start, rmw_final);
+        uint64_t ops = res.writes + res.reads + res.commits;
+        double ops_s = ops * 1000.0 / sc.duration_ms;
+        printf("%5d  %7d %7d %3d %9.0f  %10llu %9llu %10llu  %10llu\n", n, roles[0], roles[1], roles[2], ops_s,
+               (unsigned long long)res.writes, (unsigned long long)res.reads,
+               (unsigned long long)res.commits, (unsigned long long)res.violations());
+        if (res.violations()) {
+            printf("       errors=%llu torn=%llu unknown=%llu future=%llu overlaps=%llu nested=%llu rmw=%llu\n",
+                   (unsigned long long)res.errors, (unsigned long long)res.torn,
+                   (unsigned long long)res.unknown, (unsigned long long)res.future,
+                   (unsigned long long)res.overlaps, (unsigned long long)res.nested,
+                   (unsigned long long)res.rmw_errors);
+        }
+        fflush(stdout);
+        total_violations += res.violations() + failed;
+    }
+    control.close();
+    std::cout << (total_violations ? "Stress: FAILED\n" : "Stress: OK\n");
+    return total_violations ? 1 : 0;
+}
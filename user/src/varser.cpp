@@ -3,28 +3,175 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <cstring>
 #include <iostream>
 #include <memory>
 #include <vector>
 #include <algorithm>
+#include <unordered_map>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
 #include <errno.h> // Добавьте этот include
 #include "varser_ioctl.h"
 
 using namespace varser;
 
+/* size of kernel storage for a variable (kernel falls back to VARSER_DEFAULT_VAR_SIZE) */
+static size_t storage_size(const VarDesc &vd) {
+    return vd.size ? vd.size : VARSER_DEFAULT_VAR_SIZE;
+}
+
 struct Container::Impl {
     ContainerDesc desc;
     int fd{-1};
     bool opened{false};
-    Impl(const ContainerDesc &d): desc(d) {}
+
+    // write-behind: last written value per variable + dirty bit
+    struct Shadow {
+        std::vector<uint8_t> value;
+        bool dirty{false};
+        uint64_t gen{0}; // bumped by every staged value
+    };
+    std::unordered_map<std::string, size_t> index;
+    std::vector<Shadow> shadow;
+    size_t dirty_count{0};
+    bool wb_enabled{false};
+    bool wb_stop{false};
+    WriteBehindOptions wb_opts;
+    std::mutex wb_mutex; // protects everything above, never held across an ioctl
+    std::mutex flush_mutex; // serializes SET_BATCH/RESET so an older value can't land last
+    int flush_errno{0}; // last failure reported by the flush thread, under flush_mutex
+    std::condition_variable wb_cv;
+    std::thread wb_thread;
+
+    // huge_pages: read-only mapping of the container
+    void *map_base{nullptr};
+    size_t map_len{0};
+    std::vector<uint64_t> map_offsets; // per variable, from GET_SCHEMA
+
+    Impl(const ContainerDesc &d): desc(d) {
+        for (size_t i = 0; i < desc.vars.size(); ++i) index[desc.vars[i].name] = i;
+        shadow.resize(desc.vars.size());
+    }
+
+    bool stage_locked(const std::string &varname, const void *data, size_t size, bool &flush_now);
+    bool flush(bool background = false);
+    void flush_loop();
+    void start_flush_thread_locked();
 };
 
+bool Container::Impl::stage_locked(const std::string &varname, const void *data, size_t size,
+                                   bool &flush_now) {
+    flush_now = false;
+    auto it = index.find(varname);
+    if (it == index.end()) {
+        std::cerr << "Unknown variable: " << varname << std::endl;
+        errno = ENOENT;
+        return false;
+    }
+    size_t need = storage_size(desc.vars[it->second]);
+    if (size < need) { errno = EINVAL; return false; }
+
+    Shadow &sh = shadow[it->second];
+    const uint8_t *bytes = static_cast<const uint8_t *>(data);
+    sh.value.assign(bytes, bytes + need);
+    ++sh.gen;
+    if (!sh.dirty) {
+        sh.dirty = true;
+        ++dirty_count;
+    }
+    flush_now = wb_opts.dirty_threshold && dirty_count >= wb_opts.dirty_threshold;
+    return true;
+}
+
+/* Dirty values are copied under wb_mutex and sent without it, so set() never waits
+ * for kernel locks. A slot stays dirty if it was staged again while its copy was in flight.
+ * The flush thread (background) reports a failure once until it changes or clears.
+ */
+bool Container::Impl::flush(bool background) {
+    std::lock_guard<std::mutex> flk(flush_mutex);
+    struct Pending {
+        size_t slot;
+        uint64_t gen;
+        std::vector<uint8_t> value;
+    };
+    std::vector<Pending> pending;
+    {
+        std::lock_guard<std::mutex> lk(wb_mutex);
+        if (dirty_count == 0) return true;
+        pending.reserve(dirty_count);
+        for (size_t i = 0; i < shadow.size(); ++i) {
+            if (shadow[i].dirty) pending.push_back({i, shadow[i].gen, shadow[i].value});
+        }
+    }
+
+    std::vector<varser_batch_entry> entries;
+    entries.reserve(pending.size());
+    for (const auto &pd : pending) {
+        varser_batch_entry e;
+        memset(&e, 0, sizeof(e));
+        strncpy(e.var_name, desc.vars[pd.slot].name.c_str(), VARSER_MAX_VAR_NAME-1);
+        e.buf_size = (uint32_t)pd.value.size();
+        e.user_buf = (uintptr_t)pd.value.data();
+        entries.push_back(e);
+    }
+
+    for (size_t off = 0; off < entries.size(); off += VARSER_MAX_VARS) {
+        struct varser_batch batch;
+        memset(&batch, 0, sizeof(batch));
+        batch.count = (uint32_t)std::min<size_t>(entries.size() - off, VARSER_MAX_VARS);
+        batch.entries = (uintptr_t)&entries[off];
+        if (ioctl(fd, VARSER_IOCTL_SET_BATCH, &batch) != 0) {
+            int err = errno;
+            if (!background || err != flush_errno) perror("ioctl SET_BATCH");
+            if (background) flush_errno = err;
+            errno = err;
+            return false; // remaining variables stay dirty and are retried on next flush
+        }
+        std::lock_guard<std::mutex> lk(wb_mutex);
+        for (size_t k = off; k < off + batch.count; ++k) {
+            Shadow &sh = shadow[pending[k].slot];
+            if (!sh.dirty || sh.gen != pending[k].gen) continue;
+            sh.dirty = false;
+            --dirty_count;
+        }
+    }
+    flush_errno = 0;
+    return true;
+}
+
+void Container::Impl::flush_loop() {
+    std::unique_lock<std::mutex> lk(wb_mutex);
+    while (!wb_stop) {
+        wb_cv.wait_for(lk, wb_opts.interval, [this] { return wb_stop; });
+        lk.unlock();
+        flush(true);
+        lk.lock();
+    }
+}
+
+void Container::Impl::start_flush_thread_locked() {
+    wb_stop = false;
+    wb_thread = std::thread([this] { flush_loop(); });
+}
+
 Container::Container(ContainerDesc desc)
     : p(std::make_unique<Impl>(desc)) {}
 
 Container::~Container() {
-    if (p->opened) close();
+    if (!p->opened || close()) return;
+    // the final flush failed: nothing can retry after destruction
+    std::cerr << "Container '" << p->desc.name << "': unflushed write-behind values dropped\n";
+    {
+        std::lock_guard<std::mutex> lk(p->wb_mutex);
+        p->wb_stop = true;
+    }
+    p->wb_cv.notify_all();
+    if (p->wb_thread.joinable()) p->wb_thread.join();
+    unmap();
+    ::close(p->fd);
 }
 
 static uint8_t mapVarType(VarType t) {
@@ -41,60 +188,207 @@ static uint8_t mapVarType(VarType t) {
     return VARSER_TYPE_INT32;
 }
 
-bool Container::container_exists() {
-    int fd = ::open("/dev/varser", O_RDWR);
-    if (fd < 0) {
-        perror("open /dev/varser");
+static bool unmapVarType(uint8_t t, VarType &out) {
+    switch (t) {
+        case VARSER_TYPE_INT32: out = VarType::INT32; return true;
+        case VARSER_TYPE_INT64: out = VarType::INT64; return true;
+        case VARSER_TYPE_UINT8: out = VarType::UINT8; return true;
+        case VARSER_TYPE_UINT64: out = VarType::UINT64; return true;
+        case VARSER_TYPE_FLOAT: out = VarType::FLOAT; return true;
+        case VARSER_TYPE_DOUBLE: out = VarType::DOUBLE; return true;
+        case VARSER_TYPE_STRING: out = VarType::STRING; return true;
+        case VARSER_TYPE_BLOB: out = VarType::BLOB; return true;
+    }
+    return false;
+}
+
+/* false for an unknown name; empty means the default per_variable_rw */
+static bool mapLockPolicy(const std::string &policy, uint8_t &out) {
+    if (policy.empty() || policy == "per_variable_rw") out = VARSER_LOCK_VARIABLE_RW;
+    else if (policy == "per_container_mutex") out = VARSER_LOCK_CONTAINER_MUTEX;
+    else if (policy == "none") out = VARSER_LOCK_NONE;
+    else return false;
+    return true;
+}
+
+static std::string unmapLockPolicy(uint8_t policy) {
+    switch (policy) {
+        case VARSER_LOCK_NONE: return "none";
+        case VARSER_LOCK_CONTAINER_MUTEX: return "per_container_mutex";
+    }
+    return "per_variable_rw";
+}
+
+/* false for an unknown name; empty means the default reader */
+static bool mapLockPreference(const std::string &pref, uint8_t &out) {
+    if (pref.empty() || pref == "reader") out = VARSER_PREFER_READERS;
+    else if (pref == "writer") out = VARSER_PREFER_WRITERS;
+    else return false;
+    return true;
+}
+
+static std::string unmapLockPreference(uint8_t pref) {
+    return pref == VARSER_PREFER_WRITERS ? "writer" : "reader";
+}
+
+/* builds REGISTER payload; image receives the packed defaults and must outlive the ioctl */
+static bool fill_register(const ContainerDesc &desc, struct varser_register &reg, std::vector<uint8_t> &image) {
+    memset(&reg, 0, sizeof(reg));
+    image.clear();
+    strncpy(reg.container_name, desc.name.c_str(), VARSER_MAX_CONTAINER_NAME-1);
+    if (!mapLockPolicy(desc.lock_policy, reg.lock_policy)) {
+        std::cerr << "Unknown lock_policy '" << desc.lock_policy << "'\n";
         return false;
     }
-    
-    char buf[4096];
-    memset(buf, 0, sizeof(buf));
-    if (ioctl(fd, VARSER_IOC_LIST_CONTAINERS, buf) < 0) {
-        perror("ioctl LIST_CONTAINERS");
-        ::close(fd);
+    if (!mapLockPreference(desc.lock_preference, reg.lock_pref)) {
+        std::cerr << "Unknown lock_preference '" << desc.lock_preference << "'\n";
         return false;
     }
-    
-    ::close(fd);
-    
-    // Ищем имя контейнера в списке
-    std::string containers_list(buf);
-    return containers_list.find(p->desc.name) != std::string::npos;
+    if (desc.vars.size() > VARSER_MAX_VARS) {
+        std::cerr << "Container '" << desc.name << "' declares " << desc.vars.size()
+                  << " variables, at most " << VARSER_MAX_VARS << " are supported\n";
+        errno = E2BIG;
+        return false;
+    }
+    reg.flags = desc.huge_pages ? VARSER_REG_F_HUGE_PAGES : 0;
+    reg.var_count = desc.vars.size();
+    for (uint32_t i = 0; i < reg.var_count; ++i) {
+        const VarDesc &vd = desc.vars[i];
+        strncpy(reg.vars[i].name, vd.name.c_str(), VARSER_MAX_VAR_NAME-1);
+        reg.vars[i].type = mapVarType(vd.type);
+        reg.vars[i].size = vd.size;
+        reg.vars[i].history = vd.history;
+        if (!vd.default_value.empty()) {
+            reg.vars[i].flags |= VARSER_VAR_F_DEFAULT;
+            image.insert(image.end(), vd.default_value.begin(), vd.default_value.end());
+        }
+    }
+    reg.image_size = image.size();
+    reg.image = (uintptr_t)image.data();
+    return true;
 }
 
-bool Container::register_with_kernel() {
-    // Сначала проверяем, существует ли контейнер
-    if (container_exists()) {
-        std::cout << "Container '" << p->desc.name << "' already exists, skipping registration\n";
-        return true;
+/* GET_SCHEMA on an already opened /dev/varser fd; returns 0 or errno.
+ * image (optional) receives the packed defaults image.
+ */
+static int fetch_schema(int fd, const std::string &name, struct varser_register &reg,
+                        std::vector<uint8_t> *image = nullptr) {
+    memset(&reg, 0, sizeof(reg));
+    strncpy(reg.container_name, name.c_str(), VARSER_MAX_CONTAINER_NAME-1);
+    if (ioctl(fd, VARSER_IOCTL_GET_SCHEMA, &reg) != 0) return errno;
+    if (!image) return 0;
+    image->assign(reg.image_size, 0);
+    if (image->empty()) return 0;
+    // second call with a buffer of the size the kernel reported
+    reg.image = (uintptr_t)image->data();
+    if (ioctl(fd, VARSER_IOCTL_GET_SCHEMA, &reg) != 0) return errno;
+    return 0;
+}
+
+/* compares our schema with the registered one; describes the first difference in why */
+static bool schema_matches(const struct varser_register &ours, const std::vector<uint8_t> &our_image,
+                           const struct varser_register &theirs, const std::vector<uint8_t> &their_image,
+                           std::string &why) {
+    auto eff = [](uint32_t size) { return size ? size : (uint32_t)VARSER_DEFAULT_VAR_SIZE; };
+    if (ours.lock_policy != theirs.lock_policy) {
+        why = "lock_policy '" + unmapLockPolicy(ours.lock_policy) + "' vs registered '" +
+              unmapLockPolicy(theirs.lock_policy) + "'";
+        return false;
+    }
+    if (ours.lock_pref != theirs.lock_pref) {
+        why = "lock_preference '" + unmapLockPreference(ours.lock_pref) + "' vs registered '" +
+              unmapLockPreference(theirs.lock_pref) + "'";
+        return false;
+    }
+    if (ours.flags != theirs.flags) {
+        why = std::string("huge_pages ") + ((ours.flags & VARSER_REG_F_HUGE_PAGES) ? "on" : "off") +
+              " vs registered " + ((theirs.flags & VARSER_REG_F_HUGE_PAGES) ? "on" : "off");
+        return false;
+    }
+    if (ours.var_count != theirs.var_count) {
+        why = "variable count " + std::to_string(ours.var_count) + " vs registered " +
+              std::to_string(theirs.var_count);
+        return false;
     }
-    
+    size_t our_off = 0, their_off = 0;
+    for (uint32_t i = 0; i < ours.var_count; ++i) {
+        const auto &a = ours.vars[i];
+        const auto &b = theirs.vars[i];
+        if (strncmp(a.name, b.name, VARSER_MAX_VAR_NAME) != 0) {
+            why = "variable #" + std::to_string(i) + " is '" + a.name + "', registered '" + b.name + "'";
+            return false;
+        }
+        if (a.type != b.type || eff(a.size) != eff(b.size)) {
+            why = "variable '" + std::string(a.name) + "' differs in type or size";
+            return false;
+        }
+        if (a.history != b.history) {
+            why = "variable '" + std::string(a.name) + "' history " + std::to_string(a.history) +
+                  " vs registered " + std::to_string(b.history);
+            return false;
+        }
+        // a missing default means zeros, so compare the effective values
+        size_t n = eff(a.size);
+        const uint8_t *da = (a.flags & VARSER_VAR_F_DEFAULT) && our_off + n <= our_image.size()
+                            ? our_image.data() + our_off : nullptr;
+        const uint8_t *db = (b.flags & VARSER_VAR_F_DEFAULT) && their_off + n <= their_image.size()
+                            ? their_image.data() + their_off : nullptr;
+        if (a.flags & VARSER_VAR_F_DEFAULT) our_off += n;
+        if (b.flags & VARSER_VAR_F_DEFAULT) their_off += n;
+        bool same = true;
+        if (da && db) same = memcmp(da, db, n) == 0;
+        else if (da || db) same = std::all_of(da ? da : db, (da ? da : db) + n, [](uint8_t x) { return x == 0; });
+        if (!same) {
+            why = "variable '" + std::string(a.name) + "' has a different default";
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Container::register_with_kernel() {
+    struct varser_register reg;
+    std::vector<uint8_t> image;
+    if (!fill_register(p->desc, reg, image)) return false;
     int fd = ::open("/dev/varser", O_RDWR);
     if (fd < 0) {
         perror("open /dev/varser");
         return false;
     }
-    struct varser_register reg;
-    memset(&reg, 0, sizeof(reg));
-    strncpy(reg.container_name, p->desc.name.c_str(), VARSER_MAX_CONTAINER_NAME-1);
-    reg.var_count = std::min<uint32_t>(p->desc.vars.size(), VARSER_MAX_VARS);
-    for (uint32_t i = 0; i < reg.var_count; ++i) {
-        const VarDesc &vd = p->desc.vars[i];
-        strncpy(reg.vars[i].name, vd.name.c_str(), VARSER_MAX_VAR_NAME-1);
-        reg.vars[i].type = mapVarType(vd.type);
-        reg.vars[i].size = vd.size;
+    if (ioctl(fd, VARSER_IOC_REGISTER, &reg) == 0) {
+        ::close(fd);
+        std::cout << "Container '" << p->desc.name << "' registered successfully\n";
+        return true;
     }
-    if (ioctl(fd, VARSER_IOC_REGISTER, &reg) != 0) {
+    if (errno != EEXIST) {
         perror("ioctl REGISTER");
         ::close(fd);
         return false;
     }
+
+    // Already registered (maybe by a concurrent process): our schema must match the kernel's
+    struct varser_register existing;
+    std::vector<uint8_t> existing_image;
+    int err = fetch_schema(fd, p->desc.name, existing, &existing_image);
     ::close(fd);
-    std::cout << "Container '" << p->desc.name << "' registered successfully\n";
+    if (err) {
+        errno = err;
+        perror("ioctl GET_SCHEMA");
+        return false;
+    }
+    std::string why;
+    if (!schema_matches(reg, image, existing, existing_image, why)) {
+        std::cerr << "Container '" << p->desc.name << "' schema mismatch: " << why << "\n";
+        return false;
+    }
+    std::cout << "Container '" << p->desc.name << "' already exists, skipping registration\n";
     return true;
 }
 
+const ContainerDesc &Container::desc() const {
+    return p->desc;
+}
+
 bool Container::open() {
     if (p->opened) return true;
     p->fd = ::open("/dev/varser", O_RDWR);
@@ -112,6 +406,9 @@ bool Container::open() {
 }
 
 bool Container::close() {
+    // a failed final flush keeps the container open with the values still queued
+    if (!disable_write_behind()) return false;
+    unmap();
     if (!p->opened) return true;
     if (ioctl(p->fd, VARSER_IOC_CLOSE_CONTAINER) != 0) {
         perror("ioctl CLOSE_CONTAINER");
@@ -122,44 +419,403 @@ bool Container::close() {
     return true;
 }
 
-template<typename T>
-bool Container::set(const std::string &varname, const T &value) {
+/* EAGAIN/ETIMEDOUT are expected outcomes of try_/_for calls, not worth a perror */
+static void report_access_error(const char *what) {
+    if (errno != EAGAIN && errno != ETIMEDOUT) perror(what);
+}
+
+bool Container::set_bytes(const std::string &varname, const void *data, size_t size) {
+    return set_mode(varname, data, size, 0, 0);
+}
+
+bool Container::set_mode(const std::string &varname, const void *data, size_t size,
+                         uint32_t flags, uint32_t timeout_ms) {
     if (!p->opened && !open()) return false;
+    {
+        std::unique_lock<std::mutex> lk(p->wb_mutex);
+        if (p->wb_enabled) {
+            bool flush_now;
+            if (!p->stage_locked(varname, data, size, flush_now)) return false;
+            lk.unlock();
+            return !flush_now || p->flush();
+        }
+    }
     struct varser_var_access access;
     memset(&access,0,sizeof(access));
     strncpy(access.container_name, p->desc.name.c_str(), VARSER_MAX_CONTAINER_NAME-1);
     strncpy(access.var_name, varname.c_str(), VARSER_MAX_VAR_NAME-1);
-    access.buf_size = sizeof(T);
-    T tmp = value;
-    access.user_buf = (uintptr_t)&tmp;
+    access.buf_size = (uint32_t)size;
+    access.user_buf = (uintptr_t)data;
+    access.flags = flags;
+    access.timeout_ms = timeout_ms;
     if (ioctl(p->fd, VARSER_IOC_SET_VAR, &access) != 0) {
-        perror("ioctl SET_VAR");
+        report_access_error("ioctl SET_VAR");
         return false;
     }
     return true;
 }
 
-template<typename T>
-bool Container::get(const std::string &varname, T &out) {
+bool Container::get_bytes(const std::string &varname, void *data, size_t size) {
+    return get_mode(varname, data, size, 0, 0);
+}
+
+bool Container::get_mode(const std::string &varname, void *data, size_t size,
+                         uint32_t flags, uint32_t timeout_ms, ValueStatus *status) {
+    if (!p->opened && !open()) return false;
+    {
+        // a pending write-behind value is newer than the kernel copy
+        std::lock_guard<std::mutex> lk(p->wb_mutex);
+        auto it = p->index.find(varname);
+        if (p->wb_enabled && it != p->index.end() && p->shadow[it->second].dirty) {
+            const auto &v = p->shadow[it->second].value;
+            if (size < v.size()) { errno = EINVAL; return false; }
+            memcpy(data, v.data(), v.size());
+            if (status) *status = ValueStatus{};
+            return true;
+        }
+    }
+    ValueStatus st;
+    if (!get_versioned(varname, data, size, st, flags, timeout_ms)) return false;
+    if (status) *status = st;
+    return true;
+}
+
+bool Container::get_versioned(const std::string &varname, void *data, size_t size, ValueStatus &status,
+                              uint32_t flags, uint32_t timeout_ms) {
     if (!p->opened && !open()) return false;
     struct varser_var_access access;
     memset(&access,0,sizeof(access));
     strncpy(access.container_name, p->desc.name.c_str(), VARSER_MAX_CONTAINER_NAME-1);
     strncpy(access.var_name, varname.c_str(), VARSER_MAX_VAR_NAME-1);
-    access.buf_size = sizeof(T);
-    access.user_buf = (uintptr_t)&out;
+    access.buf_size = (uint32_t)size;
+    access.user_buf = (uintptr_t)data;
+    access.flags = flags;
+    access.timeout_ms = timeout_ms;
     if (ioctl(p->fd, VARSER_IOC_GET_VAR, &access) != 0) {
-        perror("ioctl GET_VAR");
+        report_access_error("ioctl GET_VAR");
+        return false;
+    }
+    status.version = access.version;
+    status.torn = access.status & VARSER_STATUS_TORN;
+    status.owner_died = access.status & VARSER_STATUS_OWNER_DIED;
+    return true;
+}
+
+bool Container::get_checked(const std::string &varname, void *data, size_t size, ValueStatus &status) {
+    return get_mode(varname, data, size, 0, 0, &status);
+}
+
+bool Container::read_mapped(const std::string &varname, void *data, size_t size, ValueStatus &status) {
+    const void *value = mapped(varname);
+    if (!value) return false;
+    size_t idx = p->index.at(varname);
+    size_t n = storage_size(p->desc.vars[idx]);
+    if (size < n) { errno = EINVAL; return false; }
+    const auto *ms = static_cast<const varser_map_status *>(p->map_base) + idx;
+    // seqlock read; only the kernel writes seq, so an odd value never lasts
+    for (int attempt = 0; attempt < 64; ++attempt) {
+        uint64_t seq = __atomic_load_n(&ms->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) {
+            std::this_thread::yield();
+            continue;
+        }
+        memcpy(data, value, n);
+        uint32_t st = __atomic_load_n(&ms->status, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&ms->seq, __ATOMIC_RELAXED) != seq) continue;
+        status = ValueStatus{};
+        status.torn = st & VARSER_STATUS_TORN;
+        status.owner_died = st & VARSER_STATUS_OWNER_DIED;
+        return true;
+    }
+    // value keeps changing under us: take the locked path
+    return get_versioned(varname, data, size, status);
+}
+
+template<typename T>
+bool Container::set(const std::string &varname, const T &value) {
+    return set_bytes(varname, &value, sizeof(T));
+}
+
+template<typename T>
+bool Container::get(const std::string &varname, T &out) {
+    return get_bytes(varname, &out, sizeof(T));
+}
+
+/* a timeout beyond the u32 millisecond range is as good as blocking */
+static uint32_t clamp_timeout(std::chrono::milliseconds timeout) {
+    auto ms = std::max<int64_t>(timeout.count(), 0);
+    return (uint32_t)std::min<int64_t>(ms, UINT32_MAX);
+}
+
+template<typename T>
+bool Container::try_get(const std::string &varname, T &out) {
+    return get_mode(varname, &out, sizeof(T), VARSER_ACCESS_NONBLOCK, 0);
+}
+
+template<typename T>
+bool Container::get_for(const std::string &varname, T &out, std::chrono::milliseconds timeout) {
+    return get_mode(varname, &out, sizeof(T), VARSER_ACCESS_TIMEOUT, clamp_timeout(timeout));
+}
+
+template<typename T>
+bool Container::try_set(const std::string &varname, const T &value) {
+    return set_mode(varname, &value, sizeof(T), VARSER_ACCESS_NONBLOCK, 0);
+}
+
+template<typename T>
+bool Container::set_for(const std::string &varname, const T &value, std::chrono::milliseconds timeout) {
+    return set_mode(varname, &value, sizeof(T), VARSER_ACCESS_TIMEOUT, clamp_timeout(timeout));
+}
+
+bool Container::enable_write_behind(const WriteBehindOptions &opts) {
+    if (opts.interval.count() <= 0) { errno = EINVAL; return false; } // the thread would spin
+    if (!p->opened && !open()) return false;
+    std::lock_guard<std::mutex> lk(p->wb_mutex);
+    p->wb_opts = opts;
+    if (p->wb_enabled) return true;
+    p->wb_enabled = true;
+    p->start_flush_thread_locked();
+    return true;
+}
+
+bool Container::disable_write_behind() {
+    {
+        std::lock_guard<std::mutex> lk(p->wb_mutex);
+        if (!p->wb_enabled) return true;
+        p->wb_stop = true;
+    }
+    p->wb_cv.notify_all();
+    if (p->wb_thread.joinable()) p->wb_thread.join();
+
+    // set() keeps staging until write-behind is off, so flush until nothing is left
+    for (;;) {
+        bool ok = p->flush();
+        std::lock_guard<std::mutex> lk(p->wb_mutex);
+        if (!ok) {
+            // stay in write-behind mode: the shadow is the newest data, the thread retries
+            p->start_flush_thread_locked();
+            return false;
+        }
+        if (p->dirty_count == 0) {
+            p->wb_enabled = false;
+            return true;
+        }
+    }
+}
+
+bool Container::flush() {
+    if (!p->opened) return true;
+    return p->flush();
+}
+
+bool Container::reset_to_defaults() {
+    if (!p->opened && !open()) return false;
+    std::lock_guard<std::mutex> flk(p->flush_mutex);
+    {
+        std::lock_guard<std::mutex> lk(p->wb_mutex);
+        for (auto &sh : p->shadow) sh.dirty = false;
+        p->dirty_count = 0;
+    }
+    if (ioctl(p->fd, VARSER_IOCTL_RESET_DEFAULTS) != 0) {
+        perror("ioctl RESET_DEFAULTS");
+        return false;
+    }
+    return true;
+}
+
+bool Container::stats(ContainerStats &out) {
+    if (!p->opened && !open()) return false;
+    struct varser_stat st;
+    memset(&st, 0, sizeof(st));
+    if (ioctl(p->fd, VARSER_IOCTL_STAT, &st) != 0) {
+        perror("ioctl STAT");
+        return false;
+    }
+    out.declared_bytes = st.declared_bytes;
+    out.resident_bytes = st.resident_bytes;
+    out.var_resident.assign(st.var_resident, st.var_resident + std::min<uint32_t>(st.var_count, VARSER_MAX_VARS));
+    out.map_size = st.map_size;
+    out.huge_bytes = st.huge_bytes;
+    return true;
+}
+
+const void *Container::mapped(const std::string &varname) {
+    auto it = p->index.find(varname);
+    if (it == p->index.end()) {
+        std::cerr << "Unknown variable " << varname << std::endl;
+        return nullptr;
+    }
+    if (!p->map_base) {
+        ContainerStats st;
+        if (!stats(st)) return nullptr;
+        if (!st.map_size) {
+            std::cerr << "Container '" << p->desc.name << "' is not mappable (needs huge_pages: true)\n";
+            return nullptr;
+        }
+        struct varser_register reg;
+        int err = fetch_schema(p->fd, p->desc.name, reg);
+        if (err) {
+            errno = err;
+            perror("ioctl GET_SCHEMA");
+            return nullptr;
+        }
+        void *base = mmap(nullptr, st.map_size, PROT_READ, MAP_SHARED, p->fd, 0);
+        if (base == MAP_FAILED) {
+            perror("mmap");
+            return nullptr;
+        }
+        p->map_offsets.clear();
+        for (uint32_t i = 0; i < reg.var_count && i < VARSER_MAX_VARS; ++i)
+            p->map_offsets.push_back(reg.vars[i].map_offset);
+        p->map_base = base;
+        p->map_len = st.map_size;
+    }
+    if (it->second >= p->map_offsets.size()) return nullptr;
+    return static_cast<const uint8_t *>(p->map_base) + p->map_offsets[it->second];
+}
+
+void Container::unmap() {
+    if (!p->map_base) return;
+    munmap(p->map_base, p->map_len);
+    p->map_base = nullptr;
+    p->map_len = 0;
+    p->map_offsets.clear();
+}
+
+bool Container::read_history(const std::string &varname, uint64_t since_version,
+                             std::vector<HistoryEntry> &out, uint64_t *dropped) {
+    out.clear();
+    if (!p->opened && !open()) return false;
+    auto it = p->index.find(varname);
+    if (it == p->index.end()) {
+        std::cerr << "Unknown variable " << varname << std::endl;
+        return false;
+    }
+    const VarDesc &vd = p->desc.vars[it->second];
+    size_t entry_size = sizeof(struct varser_history_entry) + storage_size(vd);
+    std::vector<uint8_t> buf(std::max<size_t>(vd.history, 1) * entry_size);
+
+    struct varser_history_read hr;
+    memset(&hr, 0, sizeof(hr));
+    strncpy(hr.var_name, varname.c_str(), VARSER_MAX_VAR_NAME-1);
+    hr.since_version = since_version;
+    hr.max_entries = vd.history;
+    hr.user_buf = (uintptr_t)buf.data();
+    if (ioctl(p->fd, VARSER_IOCTL_READ_HISTORY, &hr) != 0) {
+        perror("ioctl READ_HISTORY");
         return false;
     }
+    if (hr.entry_size != entry_size) {
+        std::cerr << "History entry size mismatch for " << varname << std::endl;
+        return false;
+    }
+    for (uint32_t i = 0; i < hr.count; ++i) {
+        const uint8_t *e = buf.data() + i * entry_size;
+        struct varser_history_entry h;
+        memcpy(&h, e, sizeof(h));
+        out.push_back({h.version, h.timestamp_ns,
+                       std::vector<uint8_t>(e + sizeof(h), e + entry_size)});
+    }
+    if (dropped) *dropped = hr.dropped;
     return true;
 }
 
+Transaction Container::transaction() {
+    flush();
+    return Transaction(*this);
+}
+
+bool Transaction::get_bytes(const std::string &varname, void *data, size_t size) {
+    // read-your-writes inside the transaction
+    for (auto it = writes.rbegin(); it != writes.rend(); ++it) {
+        if (it->name != varname) continue;
+        if (size < it->value.size()) { errno = EINVAL; return false; }
+        memcpy(data, it->value.data(), it->value.size());
+        return true;
+    }
+    // values staged by set() since transaction() are newer than the kernel's
+    if (!c.flush()) return false;
+    ValueStatus status;
+    if (!c.get_versioned(varname, data, size, status)) return false;
+    // the first observed version is the one to validate
+    auto seen = std::find_if(reads.begin(), reads.end(), [&](const Read &r) { return r.name == varname; });
+    if (seen == reads.end()) reads.push_back({varname, status.version});
+    return true;
+}
+
+void Transaction::set_bytes(const std::string &varname, const void *data, size_t size) {
+    const uint8_t *bytes = static_cast<const uint8_t *>(data);
+    writes.push_back({varname, std::vector<uint8_t>(bytes, bytes + size)});
+}
+
+template<typename T>
+bool Transaction::get(const std::string &varname, T &out) {
+    return get_bytes(varname, &out, sizeof(T));
+}
+
+template<typename T>
+void Transaction::set(const std::string &varname, const T &value) {
+    set_bytes(varname, &value, sizeof(T));
+}
+
+CommitResult Transaction::commit() {
+    if (!c.p->opened && !c.open()) return CommitResult::Error;
+    // an earlier set() sent by a later flush would overwrite this commit
+    if (!c.flush()) {
+        reads.clear();
+        writes.clear();
+        return CommitResult::Error;
+    }
+
+    std::vector<varser_tx_read> rd(reads.size());
+    std::vector<varser_batch_entry> wr(writes.size());
+    for (size_t i = 0; i < reads.size(); ++i) {
+        memset(&rd[i], 0, sizeof(rd[i]));
+        strncpy(rd[i].var_name, reads[i].name.c_str(), VARSER_MAX_VAR_NAME-1);
+        rd[i].version = reads[i].version;
+    }
+    for (size_t i = 0; i < writes.size(); ++i) {
+        memset(&wr[i], 0, sizeof(wr[i]));
+        strncpy(wr[i].var_name, writes[i].name.c_str(), VARSER_MAX_VAR_NAME-1);
+        wr[i].buf_size = (uint32_t)writes[i].value.size();
+        wr[i].user_buf = (uintptr_t)writes[i].value.data();
+    }
+
+    struct varser_commit cm;
+    memset(&cm, 0, sizeof(cm));
+    cm.read_count = (uint32_t)rd.size();
+    cm.write_count = (uint32_t)wr.size();
+    cm.reads = (uintptr_t)rd.data();
+    cm.writes = (uintptr_t)wr.data();
+    int rc = ioctl(c.p->fd, VARSER_IOCTL_COMMIT, &cm);
+    int err = errno;
+    reads.clear();
+    writes.clear();
+    if (rc == 0) return CommitResult::Ok;
+    if (err == VARSER_COMMIT_CONFLICT) return CommitResult::Conflict;
+    errno = err;
+    perror("ioctl COMMIT");
+    return CommitResult::Error;
+}
+
 /* explicit instantiations for common types used in examples */
 template bool Container::set<int64_t>(const std::string&, const int64_t&);
 template bool Container::get<int64_t>(const std::string&, int64_t&);
 template bool Container::set<double>(const std::string&, const double&);
 template bool Container::get<double>(const std::string&, double&);
+template bool Container::try_get<int64_t>(const std::string&, int64_t&);
+template bool Container::get_for<int64_t>(const std::string&, int64_t&, std::chrono::milliseconds);
+template bool Container::try_set<int64_t>(const std::string&, const int64_t&);
+template bool Container::set_for<int64_t>(const std::string&, const int64_t&, std::chrono::milliseconds);
+template bool Container::try_get<double>(const std::string&, double&);
+template bool Container::get_for<double>(const std::string&, double&, std::chrono::milliseconds);
+template bool Container::try_set<double>(const std::string&, const double&);
+template bool Container::set_for<double>(const std::string&, const double&, std::chrono::milliseconds);
+template bool Transaction::get<int64_t>(const std::string&, int64_t&);
+template void Transaction::set<int64_t>(const std::string&, const int64_t&);
+template bool Transaction::get<double>(const std::string&, double&);
+template void Transaction::set<double>(const std::string&, const double&);
 
 ContainerManager &ContainerManager::instance() {
     static ContainerManager mgr;
@@ -168,12 +824,61 @@ ContainerManager &ContainerManager::instance() {
 
 ContainerManager::ContainerManager() {}
 
+template<typename T>
+static void put_scalar(std::vector<uint8_t> &out, T value) {
+    memcpy(out.data(), &value, sizeof(T));
+}
+
+/* encodes YAML 'default:' into the variable's storage layout (host byte order, zero padded) */
+static void encode_default(const YAML::Node &def, VarDesc &vd) {
+    std::vector<uint8_t> out(storage_size(vd), 0);
+    switch (vd.type) {
+        case VarType::INT32: put_scalar(out, def.as<int32_t>()); break;
+        case VarType::INT64: put_scalar(out, def.as<int64_t>()); break;
+        case VarType::UINT8: {
+            // yaml-cpp reads uint8_t as a character, go through unsigned
+            unsigned v = def.as<unsigned>();
+            if (v > 0xFF) throw std::out_of_range("uint8 default out of range for " + vd.name);
+            put_scalar(out, (uint8_t)v);
+            break;
+        }
+        case VarType::UINT64: put_scalar(out, def.as<uint64_t>()); break;
+        case VarType::FLOAT: put_scalar(out, def.as<float>()); break;
+        case VarType::DOUBLE: put_scalar(out, def.as<double>()); break;
+        case VarType::STRING: {
+            // keep room for the terminating NUL
+            std::string str = def.as<std::string>();
+            if (str.size() >= out.size())
+                std::cerr << "Default of " << vd.name << " truncated to " << out.size() - 1 << " bytes\n";
+            memcpy(out.data(), str.data(), std::min(str.size(), out.size() - 1));
+            break;
+        }
+        case VarType::BLOB: {
+            // either a string of raw bytes or a list of byte values
+            std::vector<uint8_t> bytes;
+            if (def.IsSequence()) {
+                for (const auto &b : def) bytes.push_back((uint8_t)(b.as<unsigned>() & 0xFF));
+            } else {
+                std::string str = def.as<std::string>();
+                bytes.assign(str.begin(), str.end());
+            }
+            if (bytes.size() > out.size())
+                std::cerr << "Default of " << vd.name << " truncated to " << out.size() << " bytes\n";
+            memcpy(out.data(), bytes.data(), std::min(bytes.size(), out.size()));
+            break;
+        }
+    }
+    vd.default_value = std::move(out);
+}
+
 std::shared_ptr<Container> ContainerManager::load_from_yaml(const std::string &path) {
     try {
         YAML::Node root = YAML::LoadFile(path);
         ContainerDesc desc;
         desc.name = root["container"].as<std::string>();
         desc.lock_policy = root["lock_policy"].as<std::string>("per_variable_rw");
+        desc.lock_preference = root["lock_preference"].as<std::string>("reader");
+        desc.huge_pages = root["huge_pages"].as<bool>(false);
         
         if (!root["variables"]) {
             std::cerr << "No 'variables' section in YAML file: " << path << std::endl;
@@ -203,6 +908,8 @@ std::shared_ptr<Container> ContainerManager::load_from_yaml(const std::string &p
                 std::cerr << "Unknown type: " << t << " for variable " << vd.name << std::endl;
                 vd.type = VarType::INT32;
             }
+            if (n["default"]) encode_default(n["default"], vd);
+            if (n["history"]) vd.history = n["history"].as<uint32_t>();
             
             desc.vars.push_back(vd);
         }
@@ -220,4 +927,76 @@ std::shared_ptr<Container> ContainerManager::load_from_yaml(const std::string &p
         std::cerr << "Error loading YAML file " << path << ": " << e.what() << std::endl;
         return nullptr;
     }
+}
+
+std::shared_ptr<Container> ContainerManager::attach(const std::string &name) {
+    int fd = ::open("/dev/varser", O_RDWR);
+    if (fd < 0) {
+        perror("open /dev/varser");
+        return nullptr;
+    }
+    struct varser_register reg;
+    std::vector<uint8_t> image;
+    int err = fetch_schema(fd, name, reg, &image);
+    ::close(fd);
+    if (err) {
+        errno = err;
+        perror("ioctl GET_SCHEMA");
+        return nullptr;
+    }
+
+    ContainerDesc desc;
+    desc.name = name;
+    desc.lock_policy = unmapLockPolicy(reg.lock_policy);
+    desc.lock_preference = unmapLockPreference(reg.lock_pref);
+    desc.huge_pages = reg.flags & VARSER_REG_F_HUGE_PAGES;
+    size_t off = 0;
+    for (uint32_t i = 0; i < reg.var_count && i < VARSER_MAX_VARS; ++i) {
+        VarDesc vd;
+        vd.name = std::string(reg.vars[i].name, strnlen(reg.vars[i].name, VARSER_MAX_VAR_NAME));
+        if (!unmapVarType(reg.vars[i].type, vd.type)) {
+            std::cerr << "Unknown type " << (int)reg.vars[i].type << " for variable " << vd.name << std::endl;
+            return nullptr;
+        }
+        // scalars carry no size in YAML, kernel reports its storage size
+        if (vd.type == VarType::STRING || vd.type == VarType::BLOB) vd.size = reg.vars[i].size;
+        vd.history = reg.vars[i].history;
+        if (reg.vars[i].flags & VARSER_VAR_F_DEFAULT) {
+            size_t n = storage_size(vd);
+            if (off + n > image.size()) {
+                std::cerr << "Truncated defaults image for container " << name << std::endl;
+                return nullptr;
+            }
+            vd.default_value.assign(image.begin() + off, image.begin() + off + n);
+            off += n;
+        }
+        desc.vars.push_back(vd);
+    }
+    return std::make_shared<Container>(desc);
+}
+
+bool ContainerManager::owners(const std::string &name, ContainerOwners &out) {
+    int fd = ::open("/dev/varser", O_RDWR);
+    if (fd < 0) {
+        perror("open /dev/varser");
+        return false;
+    }
+    auto ow = std::make_unique<varser_owners>();
+    memset(ow.get(), 0, sizeof(*ow));
+    strncpy(ow->container_name, name.c_str(), VARSER_MAX_CONTAINER_NAME-1);
+    int rc = ioctl(fd, VARSER_IOCTL_LIST_OWNERS, ow.get());
+    ::close(fd);
+    if (rc != 0) {
+        perror("ioctl LIST_OWNERS");
+        return false;
+    }
+    out.fds.clear();
+    for (uint32_t i = 0; i < std::min<uint32_t>(ow->count, VARSER_MAX_OWNERS); ++i) {
+        const auto &o = ow->owners[i];
+        out.fds.push_back({o.pid, std::string(o.comm, strnlen(o.comm, sizeof(o.comm))), o.opened_ns});
+    }
+    out.open_count = ow->count;
+    out.map_count = ow->map_count;
+    out.refcount = ow->refcount;
+    return true;
 }
\ No newline at end of file